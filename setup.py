@@ -1,5 +1,7 @@
 # -*- coding: utf-8 -*-
 
+import os
+
 from setuptools import Extension, setup
 
 setup(name='spkmeans',
@@ -9,6 +11,8 @@ setup(name='spkmeans',
          Extension(
              'spkmeans',  
              sources = ['spkmeans.c','spkmeansmodule.c'],
+             # SPK_FLOAT32=1 builds the single precision kernels
+             define_macros = [('SPK_FLOAT32', None)] if os.environ.get('SPK_FLOAT32') else [],
             )
         ]
     )
\ No newline at end of file
@@ -1,15 +1,71 @@
+#define _POSIX_C_SOURCE 200112L
 #include <stdio.h>
 #include <assert.h>
 #include <math.h>
+#include <float.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <pthread.h>
+#define SPK_THREADS
+#endif
 #include "spkmeans.h"
 
 int k, dimension, numOfVectors = 0, changes = 1, max_iter = 300;
 float rawK, rawMaxIter;
 double *eigenVals, *eigenGaps;
-double **vectors, **centroids, **wam, **ddg, **lnorm, **V, **U;
-int **clusters, *clustersSizes;
-char *goal;
+double *ddg;
+double **vectors, **centroids, **V, **U;
+symMatrix wam, lnorm;
+char *goal, *cacheDir = NULL, *sweepKs = NULL, *scratchDir = NULL, *predictPath = NULL;
+char *batchDir = ".", *graphPath = NULL, *warmPath = NULL;
+char *checkpointPath = NULL; /*prefix of the .jacobi and .kmeans checkpoints*/
+int resumeRun = 0;
+double coresetRatio = 0; /*--coreset, spk runs on ratio*n representatives*/
+double *pointWeights = NULL; /*points each representative stands for*/
+int *coresetMap = NULL; /*representative of every input point*/
+int *pointLabels = NULL; /*kmeans labels of the vectors, kept for --labels*/
+int numOfInputPoints = 0, showLabels = 0;
+double checkpointSeconds = CHECKPOINT_SECONDS;
+checkpoint snapshot; /*the one snapshot the writer thread works on*/
+int numOfThreads = 0, maxRotations = JACOBI_MAX_ROTATIONS;
+int kmeansWorkers = 0; /*--workers, processes of the spk kmeans, 0 runs it here*/
+int numOfLandmarks = 0, numOfEigenVals = 0;
+int *landmarkRows = NULL; /*the Nystrom landmarks, see nystromEigenpairs*/
+double *landmarkDinv = NULL, *landmarkInvA = NULL; /*their D^-0.5, 1/A_cc per column*/
+double *landmarkBasis = NULL; /*m x m eigenvectors of the landmark block, row major*/
 eigenVector *eigenVectors;
+double *eigenCache = NULL; /*mapped eigen cache file, V rows point into it*/
+size_t eigenCacheSize = 0;
+void *scratchMaps[SCRATCH_MAX_BLOCKS]; /*live scratch file mappings*/
+workspace arena; /*large buffers of the current goal, see planWorkspace*/
+int planOnly = 0;
+int inWorker = 0; /*set in forked batch jobs and kmeans workers, errors end only the worker*/
+int pipelineIngest = 0; /*--pipeline, wam and degrees are built while reading*/
+int graphIngested = 0; /*wam and the raw degrees in ddg came from the ingest*/
+int profiling = 0; /*stage timers and counters, see profileStart*/
+char *profilePath = NULL, *tracePath = NULL;
+profileEvent profileEvents[PROFILE_MAX_EVENTS];
+profileCounter profileCounters[PROFILE_MAX_COUNTERS];
+int numOfProfileEvents = 0, numOfProfileCounters = 0, numOfDroppedEvents = 0;
+int *profileChanges = NULL, numOfProfileChanges = 0; /*kmeans changes per iteration*/
+double profileOrigin = 0;
+#ifdef SPK_THREADS
+pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t checkpointLock; /*guards snapshot.pending and .stop*/
+pthread_cond_t checkpointReady, checkpointIdle;
+pthread_t checkpointThread;
+#endif
+size_t scratchSizes[SCRATCH_MAX_BLOCKS];
 
 void *calloc(size_t nitems, size_t size);
 void *malloc(size_t size);
@@ -18,9 +74,17 @@ void free(void *ptr);
 char *strtok(char * str, const char *delim);
 double atof(const char * str);
 int strcmp (const char* str1, const char* str2);
+int strncmp(const char *str1, const char *str2, size_t n);
+size_t strlen(const char *str);
+long strtol(const char *str, char **endptr, int base);
 void qsort(void *base, size_t nmemb, size_t size,
            int (*compar)(const void *, const void *));
 void exit(int status);
+int mkstemp(char *template);
+void *memset(void *str, int c, size_t n);
+void *memcpy(void *dest, const void *src, size_t n);
+char *getenv(const char *name);
+char *strcpy(char *dest, const char *src);
 
 void errorAssert(int cond, int isInputError) {
     if (!cond) {
@@ -30,6 +94,12 @@ void errorAssert(int cond, int isInputError) {
         else {
             printf("An Error Has Occured");
         }
+#ifndef _WIN32
+        if (inWorker) {
+            fflush(stdout);
+            _exit(1);
+        }
+#endif
         exit(0);
     }
 }
@@ -41,7 +111,7 @@ int calcDimension(char buffer[]) {
     dimension = 0;
     i = 0;
     c = buffer[i];
-    while (c != '\n') {
+    while (c != '\n' && c != '\0') { /*the last line may have no newline*/
         if (c == ',') {
             dimension++;
         }
@@ -51,36 +121,79 @@ int calcDimension(char buffer[]) {
     return dimension+1;
 }
 
-void readFile(FILE *file) {
-    /*Reading the input file and put the data into the 'vectors' list*/
-    int j, sizeFull = 1;
-    char *vectorStr, buffer[1000];
-    double **tmp;
+char* readLine(FILE *file, char **buffer, size_t *size) {
+    /*reads a whole line into *buffer, doubling it for long lines (a jacobi
+    input has a column per point), returns NULL at the end of the file*/
+    size_t len;
+    char *tmp;
+
+    if (fgets(*buffer, (int)*size, file) == NULL) {
+        return NULL;
+    }
+    len = strlen(*buffer);
+    while (len == *size - 1 && (*buffer)[len - 1] != '\n') {
+        tmp = (char *)realloc(*buffer, 2 * *size);
+        errorAssert(tmp != NULL,0);
+        *buffer = tmp;
+        *size *= 2;
+        if (fgets(*buffer + len, (int)(*size - len), file) == NULL) {
+            break;
+        }
+        len += strlen(*buffer + len);
+    }
+    return *buffer;
+}
 
-    vectors = (double **)malloc(1 * sizeof(*vectors));
-    errorAssert(vectors != NULL,0);
+double* parseVector(char *buffer, int cols) {
+    /*parses one csv line of at most cols values, missing values are 0*/
+    int j = 0;
+    char *vectorStr = strtok(buffer, ",");
+    double *vec = (double *)calloc(cols, sizeof(double));
+    errorAssert(vec != NULL,0);
+    while (vectorStr != NULL) {
+        errorAssert(j < cols,1); /*rows must not be longer than the first*/
+        vec[j] = atof(vectorStr);
+        vectorStr = strtok(NULL, ",");
+        j++;
+    }
+    return vec;
+}
 
-    errorAssert(fgets(buffer,1000,file) != NULL,0);
-    dimension = calcDimension(buffer);
+double** readVectors(FILE *file, int *numOfRows, int *numOfCols) {
+    /*reads a csv file of vectors, the first line sets the dimension*/
+    int rows = 0, cols, sizeFull = 1;
+    char *buffer;
+    size_t bufferSize = READ_BUFFER_SIZE;
+    double **vecs, **tmp;
+
+    errorAssert(file != NULL,1);
+    vecs = (double **)malloc(1 * sizeof(*vecs));
+    errorAssert(vecs != NULL,0);
+    buffer = (char *)malloc(bufferSize);
+    errorAssert(buffer != NULL,0);
+
+    errorAssert(readLine(file, &buffer, &bufferSize) != NULL,0);
+    cols = calcDimension(buffer);
     do {
-        if (numOfVectors == sizeFull) {
+        if (rows == sizeFull) {
             sizeFull *= 2;
-            tmp = realloc(vectors, sizeFull * sizeof(*vectors));
+            tmp = realloc(vecs, sizeFull * sizeof(*vecs));
             errorAssert(tmp != NULL,0);
-            vectors = tmp;
+            vecs = tmp;
         }
-        vectorStr = strtok(buffer, ",");
-        j = 0;
-        vectors[numOfVectors] = (double *)calloc(dimension, sizeof(double)); 
-        errorAssert(vectors[numOfVectors] != NULL,0);
-        while (vectorStr != NULL) {
-            vectors[numOfVectors][j] = atof(vectorStr);
-            vectorStr = strtok(NULL, ",");
-            j++;
-        }
-        numOfVectors++;
+        vecs[rows] = parseVector(buffer, cols);
+        rows++;
     }
-    while (fgets(buffer,1000,file) != NULL);
+    while (readLine(file, &buffer, &bufferSize) != NULL);
+    free(buffer);
+    *numOfRows = rows;
+    *numOfCols = cols;
+    return vecs;
+}
+
+void readFile(FILE *file) {
+    /*Reading the input file and put the data into the 'vectors' list*/
+    vectors = readVectors(file, &numOfVectors, &dimension);
 }
 
 void assignUToVectors() {
@@ -104,26 +217,104 @@ void initCentroids() {
     }
 }
 
-double distance(double *vector1, double *vector2) {
-    /*Calculates the distance between two vectors*/
+double affinityDistanceN(double *vector1, double *vector2, int dim) {
+    /*squared distance as calcWeightsForAdjacencyMatrix sums it, any dim*/
+    double dis = 0;
+    int i;
+    for (i = 0; i < dim; i++) {
+        dis += pow(vector1[i]-vector2[i],2);
+    }
+    return dis;
+}
+
+double vectorDistanceN(double *vector1, double *vector2, int dim) {
+    /*squared distance of two vectors, any dim*/
     double dis = 0;
     int i;
-    for (i = 0; i < dimension; i++) {
+    for (i = 0; i < dim; i++) {
         dis += (vector1[i]-vector2[i])*(vector1[i]-vector2[i]);
     }
     return dis;
 }
 
-int closestCentroid(double *vector) {
-    /*Finds the closest centroid to a vector by the distance function*/
+double realDistanceN(spkReal *vector1, spkReal *vector2, int dim) {
+    /*squared distance of two spkReal vectors, accumulated in double*/
+    double dis = 0, diff;
+    int i;
+    for (i = 0; i < dim; i++) {
+        diff = (double)vector1[i] - vector2[i];
+        dis += diff*diff;
+    }
+    return dis;
+}
+
+/*the unrolled kernels add the same terms in the same order as the loops
+above, so every kernel gives bit-identical sums*/
+#define AFFINITY_TERM(v1, v2, i) pow((v1)[i]-(v2)[i],2)
+#define VECTOR_TERM(v1, v2, i) ((v1)[i]-(v2)[i])*((v1)[i]-(v2)[i])
+#define REAL_TERM(v1, v2, i) ((double)(v1)[i] - (v2)[i])*((double)(v1)[i] - (v2)[i])
+#define UNROLL1(term, v1, v2) term(v1, v2, 0)
+#define UNROLL2(term, v1, v2) UNROLL1(term, v1, v2) + term(v1, v2, 1)
+#define UNROLL3(term, v1, v2) UNROLL2(term, v1, v2) + term(v1, v2, 2)
+#define UNROLL4(term, v1, v2) UNROLL3(term, v1, v2) + term(v1, v2, 3)
+#define UNROLL5(term, v1, v2) UNROLL4(term, v1, v2) + term(v1, v2, 4)
+#define UNROLL6(term, v1, v2) UNROLL5(term, v1, v2) + term(v1, v2, 5)
+#define UNROLL7(term, v1, v2) UNROLL6(term, v1, v2) + term(v1, v2, 6)
+#define UNROLL8(term, v1, v2) UNROLL7(term, v1, v2) + term(v1, v2, 7)
+#define DISTANCE_KERNELS(d) \
+double affinityDistance##d(double *vector1, double *vector2, int dim) { \
+    (void)dim; \
+    return UNROLL##d(AFFINITY_TERM, vector1, vector2); \
+} \
+double vectorDistance##d(double *vector1, double *vector2, int dim) { \
+    (void)dim; \
+    return UNROLL##d(VECTOR_TERM, vector1, vector2); \
+} \
+double realDistance##d(spkReal *vector1, spkReal *vector2, int dim) { \
+    (void)dim; \
+    return UNROLL##d(REAL_TERM, vector1, vector2); \
+}
+
+DISTANCE_KERNELS(1)
+DISTANCE_KERNELS(2)
+DISTANCE_KERNELS(3)
+DISTANCE_KERNELS(4)
+DISTANCE_KERNELS(5)
+DISTANCE_KERNELS(6)
+DISTANCE_KERNELS(7)
+DISTANCE_KERNELS(8)
+
+distanceKernel affinityKernels[KERNEL_MAX_DIM + 1] = {affinityDistanceN,
+    affinityDistance1, affinityDistance2, affinityDistance3, affinityDistance4,
+    affinityDistance5, affinityDistance6, affinityDistance7, affinityDistance8};
+distanceKernel vectorKernels[KERNEL_MAX_DIM + 1] = {vectorDistanceN,
+    vectorDistance1, vectorDistance2, vectorDistance3, vectorDistance4,
+    vectorDistance5, vectorDistance6, vectorDistance7, vectorDistance8};
+realDistanceKernel realKernels[KERNEL_MAX_DIM + 1] = {realDistanceN,
+    realDistance1, realDistance2, realDistance3, realDistance4,
+    realDistance5, realDistance6, realDistance7, realDistance8};
+
+double vectorDistance(double *vector1, double *vector2, int dim) {
+    /*Calculates the squared distance between two vectors of length dim*/
+    return DISTANCE_KERNEL(vectorKernels, dim)(vector1, vector2, dim);
+}
+
+double distance(double *vector1, double *vector2) {
+    /*Calculates the distance between two vectors*/
+    return vectorDistance(vector1, vector2, dimension);
+}
+
+int nearestCentroid(double *vector, double **cents, int numOfCents, int dim) {
+    /*Finds the closest of numOfCents centroids to a vector*/
     double minDis, dis;
     int minCenInd,i;
+    distanceKernel kernel = DISTANCE_KERNEL(vectorKernels, dim);
     
-    minDis = distance(vector, centroids[0]); /*Initiate the minimum distance to be the distance from the first centroid*/
+    minDis = kernel(vector, cents[0], dim); /*Initiate the minimum distance to be the distance from the first centroid*/
     minCenInd = 0; /*Initiate the closest centroid to be the first one*/
     
-    for (i = 0; i < k; i++) { /*For each centroid (there are K)*/
-        dis = distance(vector, centroids[i]);
+    for (i = 0; i < numOfCents; i++) { /*For each centroid*/
+        dis = kernel(vector, cents[i], dim);
         if (dis < minDis) {
             minDis = dis;
             minCenInd = i;
@@ -131,653 +322,3564 @@ int closestCentroid(double *vector) {
     }   
     return minCenInd;
 }
- 
-void assignVectorToCluster() {
-    /*Finds the closest centroid for each vector and adds
-    the vector to the centroids cluster*/
-    int i, newCentroidInd, clusterSize;
-    int * cluster;
-
-    /*Clearing all cluster sizes (we do not want to remember what was here)*/
-    free(clustersSizes);
-    clustersSizes = (int *)calloc(k, sizeof(int));
-    errorAssert(clustersSizes != NULL,0);
-
-    /*Clearing all clusters (we do not want to remember what was here)*/
-    for (i = 0; i < k; i++) { 
-        free(clusters[i]);
-        clusters[i] = (int *)calloc(numOfVectors, sizeof(int));
-        errorAssert(clusters[i] != NULL,0);
-    }
-        
-    for (i = 0; i < numOfVectors; i++) {
-        newCentroidInd = closestCentroid(vectors[i]); /*Finds the closest centroid*/
-        cluster = clusters[newCentroidInd];
-        clusterSize = clustersSizes[newCentroidInd];
-        cluster[clusterSize] = i; /*Adds the vector to the appropriate cluster*/
-        clustersSizes[newCentroidInd]++;
-    }
-}
-
-double* calcCentroidForCluster(int clusterInd) {
-    /*Calculates the centroid for a given cluster*/
-    int numOfVectorsInCluster, i, j;
-    int * cluster;
-    double * sumVector = (double *)calloc(dimension, sizeof(double));
-    errorAssert(sumVector != NULL,0);
-    numOfVectorsInCluster = clustersSizes[clusterInd];
-    cluster = clusters[clusterInd];
-    
-    if (numOfVectorsInCluster != 0) {
-        for (i = 0; i < dimension; i++) {
-            for (j = 0; j < numOfVectorsInCluster; j++) {
-                sumVector[i] += (vectors[cluster[j]])[i];
+
+int closestCentroid(double *vector) {
+    /*Finds the closest centroid to a vector by the distance function*/
+    return nearestCentroid(vector, centroids, k, dimension);
+}
+
+double realDistance(spkReal *vector1, spkReal *vector2, int dim) {
+    /*squared distance of two spkReal vectors, accumulated in double*/
+    return DISTANCE_KERNEL(realKernels, dim)(vector1, vector2, dim);
+}
+
+int nearestRealCentroid(spkReal *vector, spkReal *cents, int numOfCents, int dim) {
+    /*nearestCentroid over the packed spkReal copies of a kmeansState*/
+    double minDis, dis;
+    int minCenInd, i;
+    realDistanceKernel kernel = DISTANCE_KERNEL(realKernels, dim);
+
+    minDis = kernel(vector, cents, dim);
+    minCenInd = 0;
+    for (i = 1; i < numOfCents; i++) {
+        dis = kernel(vector, cents + (size_t)i*dim, dim);
+        if (dis < minDis) {
+            minDis = dis;
+            minCenInd = i;
+        }
+    }
+    return minCenInd;
+}
+
+void dotBlock(spkReal *points, spkReal *cents, int dim, double *dots, int stride) {
+    /*register blocked microkernel: the ASSIGN_BLOCK x ASSIGN_BLOCK dot
+    products of 4 consecutive packed points with 4 consecutive centroids,
+    each x is loaded once per 4 centroids and each c once per 4 points*/
+    int j;
+    double a0, a1, a2, a3, b0, b1, b2, b3;
+    double s00 = 0, s01 = 0, s02 = 0, s03 = 0, s10 = 0, s11 = 0, s12 = 0, s13 = 0;
+    double s20 = 0, s21 = 0, s22 = 0, s23 = 0, s30 = 0, s31 = 0, s32 = 0, s33 = 0;
+    spkReal *x0 = points, *x1 = points + dim, *x2 = points + 2*dim, *x3 = points + 3*dim;
+    spkReal *c0 = cents, *c1 = cents + dim, *c2 = cents + 2*dim, *c3 = cents + 3*dim;
+
+    for (j = 0; j < dim; j++) {
+        a0 = x0[j]; a1 = x1[j]; a2 = x2[j]; a3 = x3[j];
+        b0 = c0[j]; b1 = c1[j]; b2 = c2[j]; b3 = c3[j];
+        s00 += a0*b0; s01 += a0*b1; s02 += a0*b2; s03 += a0*b3;
+        s10 += a1*b0; s11 += a1*b1; s12 += a1*b2; s13 += a1*b3;
+        s20 += a2*b0; s21 += a2*b1; s22 += a2*b2; s23 += a2*b3;
+        s30 += a3*b0; s31 += a3*b1; s32 += a3*b2; s33 += a3*b3;
+    }
+    dots[0] = s00; dots[1] = s01; dots[2] = s02; dots[3] = s03;
+    dots += stride;
+    dots[0] = s10; dots[1] = s11; dots[2] = s12; dots[3] = s13;
+    dots += stride;
+    dots[0] = s20; dots[1] = s21; dots[2] = s22; dots[3] = s23;
+    dots += stride;
+    dots[0] = s30; dots[1] = s31; dots[2] = s32; dots[3] = s33;
+}
+
+void dotRows(spkReal *points, int numOfRows, spkReal *cents, int numOfCols, int dim, double *dots, int stride) {
+    /*dot products of numOfRows points with numOfCols centroids, the
+    edges that do not fill a whole dotBlock*/
+    int r, c, j;
+    double sum;
+    for (r = 0; r < numOfRows; r++) {
+        for (c = 0; c < numOfCols; c++) {
+            sum = 0;
+            for (j = 0; j < dim; j++) {
+                sum += (double)points[(size_t)r*dim+j]*cents[(size_t)c*dim+j];
             }
+            dots[(size_t)r*stride+c] = sum;
         }
+    }
+}
 
-        for (i = 0; i < dimension; i++) {
-            sumVector[i] /= numOfVectorsInCluster; /*Replace the sum with the average*/
+void assignBlocked(kmeansState *state) {
+    /*labels every point with its nearest centroid for large k: the
+    distances of ASSIGN_BLOCK points at a time come from |x|^2 + |c|^2 -
+    2 x.c with the dot products in dotBlock tiles, which rounds
+    differently from the exact sum. Every centroid within the rounding
+    bound of the best is checked with the exact kernel in index order,
+    so the labels are the ones nearestRealCentroid gives*/
+    int i, r, c, j, rows, best, dim = state->dim, numOfCents = state->k;
+    int fullCols = numOfCents - numOfCents % ASSIGN_BLOCK;
+    double *dots, *centNorms, *centLengths, pointNorm, pointLength;
+    double bound, lowest, dis, minDis = 0, scale = (2*dim + 8)*DBL_EPSILON;
+    spkReal *point, *cents = state->realCentroids;
+    realDistanceKernel kernel = DISTANCE_KERNEL(realKernels, dim);
+
+    dots = (double *)calloc((size_t)ASSIGN_BLOCK*numOfCents, sizeof(double));
+    centNorms = (double *)calloc(numOfCents, sizeof(double));
+    centLengths = (double *)calloc(numOfCents, sizeof(double));
+    errorAssert(dots != NULL && centNorms != NULL && centLengths != NULL,0);
+    for (c = 0; c < numOfCents; c++) {
+        for (j = 0; j < dim; j++) {
+            centNorms[c] += (double)cents[(size_t)c*dim+j]*cents[(size_t)c*dim+j];
         }
+        centLengths[c] = sqrt(centNorms[c]);
     }
-    else {
-        for (i = 0; i < dimension; i++) {
-            sumVector[i] = centroids[clusterInd][i];
+    for (i = 0; i < state->numOfPoints; i += ASSIGN_BLOCK) {
+        point = state->realPoints + (size_t)i*dim;
+        rows = state->numOfPoints - i < ASSIGN_BLOCK ? state->numOfPoints - i : ASSIGN_BLOCK;
+        if (rows == ASSIGN_BLOCK) {
+            for (c = 0; c < fullCols; c += ASSIGN_BLOCK) {
+                dotBlock(point, cents + (size_t)c*dim, dim, dots + c, numOfCents);
+            }
+            dotRows(point, rows, cents + (size_t)fullCols*dim, numOfCents - fullCols,
+                dim, dots + fullCols, numOfCents);
+        }
+        else {
+            dotRows(point, rows, cents, numOfCents, dim, dots, numOfCents);
+        }
+        for (r = 0; r < rows; r++, point += dim) {
+            pointNorm = 0;
+            for (j = 0; j < dim; j++) {
+                pointNorm += (double)point[j]*point[j];
+            }
+            pointLength = sqrt(pointNorm);
+            /*dots[r][c] becomes the distance, then the lowest upper bound*/
+            lowest = 0;
+            for (c = 0; c < numOfCents; c++) {
+                dis = pointNorm + centNorms[c] - 2*dots[(size_t)r*numOfCents+c];
+                dots[(size_t)r*numOfCents+c] = dis;
+                bound = dis + scale*(pointLength + centLengths[c])*(pointLength + centLengths[c]);
+                lowest = (c == 0 || bound < lowest) ? bound : lowest;
+            }
+            best = -1;
+            for (c = 0; c < numOfCents; c++) {
+                dis = dots[(size_t)r*numOfCents+c];
+                if (dis - scale*(pointLength + centLengths[c])*(pointLength + centLengths[c]) > lowest) {
+                    continue; /*cannot be the nearest*/
+                }
+                dis = kernel(point, cents + (size_t)c*dim, dim);
+                if (best < 0 || dis < minDis) {
+                    minDis = dis;
+                    best = c;
+                }
+            }
+            state->labels[i + r] = best;
         }
     }
-    
-    return sumVector;
+    free(dots);
+    free(centNorms);
+    free(centLengths);
 }
 
-void updateCentroidValue() {
-    /*Updates the centroid value for each cluster and checks if 
-    it is different then what we had before*/
+void initKmeansState(kmeansState *state, double **points, int numOfPoints,
+                     int dim, double **cents, int numOfCents) {
+    /*Sets up a kmeans run over points starting from cents, the state does
+    not own points or cents but keeps packed spkReal copies of both for the
+    distance kernels*/
     int i, j;
-    double * newValue;
-    changes = 0;
-    for (i = 0; i < k; i++) {
-        newValue = calcCentroidForCluster(i);
-        for (j = 0; j < dimension; j++) {
-            if (newValue[j] != centroids[i][j]) { /*If the centroid changed*/
-                changes += 1;
-            }    
-            centroids[i][j] = newValue[j];
+    state->points = points;
+    state->centroids = cents;
+    state->numOfPoints = numOfPoints;
+    state->dim = dim;
+    state->k = numOfCents;
+    state->iteration = 0;
+    state->changes = 1;
+    state->weights = NULL;
+
+    state->labels = (int *)calloc(numOfPoints, sizeof(int));
+    errorAssert(state->labels != NULL,0);
+    state->counts = (int *)calloc(numOfCents, sizeof(int));
+    errorAssert(state->counts != NULL,0);
+    state->mass = (double *)calloc(numOfCents, sizeof(double));
+    errorAssert(state->mass != NULL,0);
+    state->sums = (double **)calloc(numOfCents, sizeof(double *));
+    errorAssert(state->sums != NULL,0);
+    for (i = 0; i < numOfCents; i++) {
+        state->sums[i] = (double *)calloc(dim, sizeof(double));
+        errorAssert(state->sums[i] != NULL,0);
+    }
+    state->realPoints = (spkReal *)calloc((size_t)numOfPoints*dim, sizeof(spkReal));
+    errorAssert(state->realPoints != NULL || numOfPoints*dim == 0,0);
+    state->realCentroids = (spkReal *)calloc((size_t)numOfCents*dim, sizeof(spkReal));
+    errorAssert(state->realCentroids != NULL || numOfCents*dim == 0,0);
+    for (i = 0; i < numOfPoints; i++) {
+        for (j = 0; j < dim; j++) {
+            state->realPoints[(size_t)i*dim+j] = (spkReal)points[i][j];
+        }
+    }
+    for (i = 0; i < numOfCents; i++) {
+        for (j = 0; j < dim; j++) {
+            state->realCentroids[(size_t)i*dim+j] = (spkReal)cents[i][j];
         }
-        free(newValue);
     }
 }
 
-void deepClone(double **a, double** b){
-    /*clones b matrix values to a*/
-    int i,j;
-    for (i = 0; i < numOfVectors; i++) {
-        for (j = 0; j < numOfVectors; j++) {
-            a[i][j] = b[i][j];
+void assignPointsToClusters(kmeansState *state) {
+    /*Finds the closest centroid for each point and adds the point
+    to its cluster's sum and count, scaled by its weight if it has one*/
+    int i, j, c;
+    double *sum, *point, w;
+
+    for (c = 0; c < state->k; c++) { /*we do not want to remember what was here*/
+        state->counts[c] = 0;
+        state->mass[c] = 0;
+        for (j = 0; j < state->dim; j++) {
+            state->sums[c][j] = 0;
         }
     }
-}
 
-void printMatrix(double** mat, int numOfRows, int numOfCols) {
-    /*prints a matrix*/
-    int i, j;
-    for (i = 0; i < numOfRows; i++) {
-        for (j = 0; j < numOfCols; j++) {
-            if ((mat[i][j]<0)&&(mat[i][j]>-0.00005)){
-                mat[i][j] = 0;
-            }
-            printf("%.4f", mat[i][j]); /*format the floats precision to 4 digits*/
-            if (j < numOfCols - 1) {
-                printf(",");
+    if (state->k >= ASSIGN_BLOCK_MIN_K) { /*all labels at once*/
+        assignBlocked(state);
+    }
+    for (i = 0; i < state->numOfPoints; i++) {
+        point = state->points[i];
+        if (state->k < ASSIGN_BLOCK_MIN_K) {
+            state->labels[i] = nearestRealCentroid(state->realPoints + (size_t)i*state->dim,
+                state->realCentroids, state->k, state->dim);
+        }
+        c = state->labels[i];
+        state->counts[c]++;
+        sum = state->sums[c];
+        if (state->weights != NULL) {
+            w = state->weights[i];
+            state->mass[c] += w;
+            for (j = 0; j < state->dim; j++) {
+                sum[j] += w*point[j];
             }
+            continue;
         }
-        if (i < numOfRows - 1) {
-            printf("\n");
+        for (j = 0; j < state->dim; j++) {
+            sum[j] += point[j]; /*points are added in index order, in double*/
         }
     }
 }
 
-double** matrixMultiplication(double** a, double** b){
-    /*gets two matrixes and multiplies them*/
-    int i,j,k;
-    double** mul = (double **)calloc(numOfVectors, numOfVectors*sizeof(double));
-    errorAssert(mul != NULL,0);
-    for (i = 0; i < numOfVectors; i++) {
-        mul[i] = (double *)calloc(numOfVectors, sizeof(double));
-        errorAssert(mul[i] != NULL,0);
+void updateCentroids(kmeansState *state) {
+    /*Replaces each centroid with the (weighted) average of its cluster (an
+    empty cluster keeps its centroid) and counts the changed coordinates*/
+    int c, j;
+    double newValue;
+    state->changes = 0;
+    for (c = 0; c < state->k; c++) {
+        if (state->counts[c] == 0) {
+            continue;
+        }
+        for (j = 0; j < state->dim; j++) {
+            newValue = state->sums[c][j] / (state->weights != NULL ? state->mass[c] : state->counts[c]);
+            if (newValue != state->centroids[c][j]) { /*If the centroid changed*/
+                state->changes += 1;
+            }
+            state->centroids[c][j] = newValue;
+            state->realCentroids[(size_t)c*state->dim+j] = (spkReal)newValue;
+        }
     }
-
-    for(i = 0; i < numOfVectors; i++){    
-        for(j = 0; j < numOfVectors; j++){    
-            mul[i][j]=0;    
-            for(k = 0; k < numOfVectors; k++){
-                /*by matrixes multiplication rules*/    
-                mul[i][j] += a[i][k] * b[k][j];     
-            }    
-        }    
-    } 
-    return mul;   
+    state->iteration++;
 }
 
-void squareMatrixTranspose(double **matrix, int numOfRows) {
-    /*transpose a squared matrix*/
-    int i,j;
-    double tmp;
-    for (i = 1; i < numOfRows; i++) {
-        for (j = 0; j < i; j++) {
-            tmp = matrix[i][j];
-            matrix[i][j] = matrix[j][i];
-            matrix[j][i] = tmp;
-        }
+void runKmeansState(kmeansState *state, int maxIter) {
+    /*runs kmeans iterations until convergence or maxIter iterations*/
+    while ((state->iteration < maxIter) && (state->changes > 0)) {
+        assignPointsToClusters(state);
+        updateCentroids(state);
     }
 }
 
-double calcWeightsForAdjacencyMatrix(double *vector1, double *vector2){
-    /*gets two vectors and calculates wij for them*/
-    double dis = 0;
+double kmeansInertia(kmeansState *state) {
+    /*sum of squared distances of the points from their cluster's centroid*/
     int i;
-    for (i = 0; i < dimension; i++) { 
-        /*calculates the euclidean distance between two vectors*/
-        dis += pow(vector1[i]-vector2[i],2);
+    double inertia = 0;
+    for (i = 0; i < state->numOfPoints; i++) {
+        inertia += (state->weights != NULL ? state->weights[i] : 1)*vectorDistance(
+            state->points[i], state->centroids[state->labels[i]], state->dim);
     }
-    dis = sqrt(dis); /*added factors according to instructions*/
-    dis = -0.5*dis; /*added factors according to instructions*/
-    
-    return exp(dis);
-} 
+    return inertia;
+}
 
-double** weightedAdjacencyMatrix(){
-    /*calculates weighted adjacency matrix after vectors matrix was set up*/
-    int i, j;
+void freeKmeansState(kmeansState *state) {
+    free2DDoubleArray(state->sums, state->k);
+    free(state->realPoints);
+    free(state->realCentroids);
+    free(state->counts);
+    free(state->mass);
+    free(state->labels);
+}
 
-    wam = (double **)calloc(numOfVectors, numOfVectors*sizeof(double));
-    errorAssert(wam != NULL,0);
-    for (i = 0; i < numOfVectors; i++) {
-        wam[i] = (double *)calloc(numOfVectors, sizeof(double));
-        errorAssert(wam[i] != NULL,0);
+void kmeansCheckpointHeader(kmeansState *state, unsigned int *header) {
+    /*key of a kmeans checkpoint: the sizes, a hash of the points and of
+    the initial centroids*/
+    int i;
+    unsigned int hash[2], params[3];
+
+    params[0] = (unsigned int)state->numOfPoints;
+    params[1] = (unsigned int)state->k;
+    params[2] = (unsigned int)state->dim;
+    hash[0] = 2166136261u;
+    hash[1] = 5381u;
+    hashBytes(hash, params, sizeof(params));
+    for (i = 0; i < state->numOfPoints; i++) {
+        hashBytes(hash, state->points[i], state->dim*sizeof(double));
     }
-
-    for (i = 0; i < numOfVectors; i++){
-        double* vector1 = vectors[i]; /*gets vector i*/
-        for (j = i+1; j < numOfVectors; j++){ 
-            double* vector2 = vectors[j]; /*gets vector j*/
-            wam[i][j] = calcWeightsForAdjacencyMatrix(vector1, vector2);
-            wam[j][i] = wam[i][j]; /*wam is symetric*/
-        }
+    for (i = 0; i < state->k; i++) {
+        hashBytes(hash, state->centroids[i], state->dim*sizeof(double));
     }
-
-    return wam;
+    header[0] = CHECKPOINT_MAGIC;
+    header[1] = CHECKPOINT_VERSION;
+    header[2] = CHECKPOINT_KMEANS;
+    header[3] = params[0];
+    header[4] = (unsigned int)(state->k*state->dim);
+    header[5] = hash[0];
+    header[6] = hash[1];
+    header[7] = header[8] = header[9] = 0; /*iteration, changes, reserved*/
 }
 
-double** diagonalDegreeMatrix(int calcWam, int toPrint){
-    /*/*calculates diagonal degree matrix*/
-    int i,j;
-
-    if (calcWam==1){ /*if wam wasn't calculated before, used in lnorm*/
-        wam = weightedAdjacencyMatrix();
+int saveKmeansCheckpoint(kmeansState *state, unsigned int *header, int wait) {
+    /*snapshot of the centroids, the iteration and the changes*/
+    int i;
+    size_t *sizes = (size_t *)calloc(state->k + 1, sizeof(size_t));
+    errorAssert(sizes != NULL,0);
+    for (i = 0; i < state->k; i++) {
+        sizes[i] = state->dim;
     }
+    header[7] = (unsigned int)state->iteration;
+    header[8] = (unsigned int)state->changes;
+    i = saveCheckpoint(".kmeans", header, state->centroids, state->k, sizes, wait);
+    free(sizes);
+    return i;
+}
 
-    ddg = (double **)calloc(numOfVectors, numOfVectors*sizeof(double));
-    errorAssert(ddg != NULL,0);
-    for (i = 0; i < numOfVectors; i++) {
-        ddg[i] = (double *)calloc(numOfVectors, sizeof(double));
-        errorAssert(ddg[i] != NULL,0);
+int loadKmeansCheckpoint(kmeansState *state, unsigned int *header) {
+    /*restores the centroids, the iteration and the changes of a run*/
+    int i, j, isLoaded;
+    double **cents = (double **)calloc(state->k + 1, sizeof(double *));
+    size_t *sizes = (size_t *)calloc(state->k + 1, sizeof(size_t));
+
+    errorAssert(cents != NULL && sizes != NULL,0);
+    for (i = 0; i < state->k; i++) {
+        cents[i] = (double *)calloc(state->dim + 1, sizeof(double));
+        errorAssert(cents[i] != NULL,0);
+        sizes[i] = state->dim;
     }
-
-    for (i = 0; i < numOfVectors; i++) {
-        double sum = 0;
-        for (j = 0; j < numOfVectors; j++){
-            sum += wam[i][j]; /*sums the row*/
+    isLoaded = loadCheckpoint(".kmeans", header, cents, state->k, sizes);
+    if (isLoaded) {
+        for (i = 0; i < state->k; i++) {
+            for (j = 0; j < state->dim; j++) {
+                state->centroids[i][j] = cents[i][j];
+                state->realCentroids[(size_t)i*state->dim+j] = (spkReal)cents[i][j];
+            }
         }
+        state->iteration = (int)header[7];
+        state->changes = (int)header[8];
+    }
+    free2DDoubleArray(cents, state->k);
+    free(sizes);
+    return isLoaded;
+}
 
-        if (toPrint==1){ /*if was called for ddg goal, only need to be printed*/
-            ddg[i][i] = sum;
+void runKmeans() {
+    /*runs kmeans iterations on vectors from the current centroids
+    until convergence or max_iter iterations*/
+    kmeansState state;
+    kmeansTransport transport;
+    double start = PROFILE_NOW(), lastCheckpoint = -1;
+    unsigned int header[CHECKPOINT_HEADER];
+    int isResumed = 0, isStepped = 0;
+
+    initKmeansState(&state, vectors, numOfVectors, dimension, centroids, k);
+    state.weights = pointWeights;
+    if (checkpointPath != NULL) {
+        kmeansCheckpointHeader(&state, header);
+        isResumed = resumeRun && loadKmeansCheckpoint(&state, header);
+    }
+    if (kmeansWorkers > 0) { /*every worker needs at least one row*/
+        localTransport(&transport, kmeansWorkers < numOfVectors ? kmeansWorkers : numOfVectors);
+        transport.start(&transport, &state);
+    }
+    while ((state.iteration < max_iter) && (state.changes > 0)) {
+        isStepped = 1;
+        if (kmeansWorkers > 0) {
+            distributedStep(&state, &transport);
+        }
+        else {
+            runKmeansState(&state, state.iteration + 1); /*one at a time for the profile*/
+        }
+        if (profiling) {
+            profileChange(state.changes);
+        }
+        if (checkpointDue(&lastCheckpoint) && saveKmeansCheckpoint(&state, header, 0)) {
+            lastCheckpoint = profileNow();
         }
-        else{
-            ddg[i][i] = 1/sqrt(sum); /*if was called for further calculations*/
-        }  
     }
-        
-    return ddg;
-} 
-
-double** laplacianNorm(){
-    /*calculated the laplacian norm matrix*/
-    int i,j;
-    double **tmp;
+    if (kmeansWorkers > 0) { /*the workers hold the last labels*/
+        stopWorkers(&state, &transport);
+    }
+    if (!isStepped && showLabels) { /*resumed a finished run, the checkpoint has no labels*/
+        assignPointsToClusters(&state);
+    }
+    if (checkpointPath != NULL) {
+        saveKmeansCheckpoint(&state, header, 1);
+    }
+    changes = state.changes;
+    if (showLabels) {
+        pointLabels = (int *)calloc(numOfVectors, sizeof(int));
+        errorAssert(pointLabels != NULL || numOfVectors == 0,0);
+        memcpy(pointLabels, state.labels, numOfVectors*sizeof(int));
+    }
+    if (profiling) {
+        profileStage("kmeans", start, k);
+        profileCount("k", k);
+        profileCount("kmeans_iterations", state.iteration);
+        profileCount("kmeans_resumed", isResumed);
+        profileCount("kmeans_workers", kmeansWorkers > 0 ? transport.numOfWorkers : 0);
+    }
+    freeKmeansState(&state);
+}
 
-    wam = weightedAdjacencyMatrix(); /*calling wam*/
-    ddg = diagonalDegreeMatrix(0,0); /*calling ddg without the need to calculate wam*/
-    
-    /*multiplies according to formula*/
-    tmp = matrixMultiplication(ddg, wam);
-    lnorm =  matrixMultiplication(tmp,ddg); 
-    free2DDoubleArray(tmp, numOfVectors);
+void partitionRows(int numOfRows, int numOfParts, int part, int *from, int *to) {
+    /*rows from..to-1 of part, the parts differ by at most one row*/
+    *from = (int)((long)numOfRows*part/numOfParts);
+    *to = (int)((long)numOfRows*(part + 1)/numOfParts);
+}
 
-    for (i = 0; i < numOfVectors; i++){
-        for (j = 0; j < numOfVectors; j++){
-            if (i==j){
-                lnorm[i][j] = 1-lnorm[i][j]; /*I - matrix*/
+void kmeansWorker(kmeansTransport *transport, kmeansState *state) {
+    /*runs in a worker until KMEANS_STOP: assigns the rows of its partition
+    of state to the centroids it is sent and returns the per cluster counts,
+    then the weight sums and coordinate sums in one message. Its labels
+    are sent last. The rows are only read, state belongs to the coordinator*/
+    int from, to, command, c, j, numOfCents = state->k, dim = state->dim;
+    double **cents, *message;
+    kmeansState part;
+
+    partitionRows(state->numOfPoints, transport->numOfWorkers, transport->rank, &from, &to);
+    cents = (double **)calloc(numOfCents, sizeof(double *));
+    message = (double *)calloc((size_t)numOfCents*(dim + 1), sizeof(double));
+    errorAssert(cents != NULL && message != NULL,0);
+    for (c = 0; c < numOfCents; c++) {
+        cents[c] = (double *)calloc(dim, sizeof(double));
+        errorAssert(cents[c] != NULL,0);
+    }
+    initKmeansState(&part, state->points + from, to - from, dim, cents, numOfCents);
+    part.weights = state->weights != NULL ? state->weights + from : NULL;
+    while (transport->receive(transport, KMEANS_COORDINATOR, &command, sizeof(int))
+        && command == KMEANS_ASSIGN) {
+        errorAssert(transport->receive(transport, KMEANS_COORDINATOR, message,
+            (size_t)numOfCents*dim*sizeof(double)),0);
+        for (c = 0; c < numOfCents; c++) {
+            for (j = 0; j < dim; j++) {
+                cents[c][j] = message[(size_t)c*dim+j];
+                part.realCentroids[(size_t)c*dim+j] = (spkReal)cents[c][j];
             }
-            else{
-                lnorm[i][j] = (-1)*lnorm[i][j]; /*I - matrix*/
+        }
+        assignPointsToClusters(&part);
+        for (c = 0; c < numOfCents; c++) {
+            for (j = 0; j < dim; j++) {
+                message[(size_t)c*dim+j] = part.sums[c][j];
             }
+            message[(size_t)numOfCents*dim+c] = part.mass[c];
         }
+        errorAssert(transport->send(transport, KMEANS_COORDINATOR, part.counts, numOfCents*sizeof(int))
+            && transport->send(transport, KMEANS_COORDINATOR, message,
+            (size_t)numOfCents*(dim + 1)*sizeof(double)),0);
     }
-    return lnorm;
+    errorAssert(transport->send(transport, KMEANS_COORDINATOR, part.labels, (to - from)*sizeof(int)),0);
+    freeKmeansState(&part);
+    free2DDoubleArray(cents, numOfCents);
+    free(message);
 }
 
-int* maxOffDiagonalValue(double** mat){
-    /*calculates the indexes of max off-diagonal element in a matrix*/
-    int i,j;
-    int maxRow = 0;
-    int maxCol = 1; /*initialized as the first off-diagonal element*/
-    int* res;
-
-    for (i = 0; i < numOfVectors; i++){
-        for (j = i+1; j < numOfVectors; j++){
-            /*finds the max off-diagonal element*/
-            if (fabs(mat[i][j])>fabs(mat[maxRow][maxCol])){ 
-                maxRow = i;
-                maxCol = j;
+void distributedStep(kmeansState *state, kmeansTransport *transport) {
+    /*one kmeans iteration on the workers: the centroids go to all of them
+    before any partial result is read, so they assign in parallel. The
+    partial counts and sums are reduced in worker order and the centroids
+    are updated here. With one worker the sums are those of
+    runKmeansState bit for bit, more workers add partial sums and can
+    differ from it in the last bits*/
+    int w, c, j, command = KMEANS_ASSIGN, numOfCents = state->k, dim = state->dim;
+    int *counts = (int *)calloc(numOfCents, sizeof(int));
+    double *message = (double *)calloc((size_t)numOfCents*(dim + 1), sizeof(double));
+
+    errorAssert(counts != NULL && message != NULL,0);
+    for (c = 0; c < numOfCents; c++) {
+        for (j = 0; j < dim; j++) {
+            message[(size_t)c*dim+j] = state->centroids[c][j];
+        }
+    }
+    for (w = 0; w < transport->numOfWorkers; w++) {
+        errorAssert(transport->send(transport, w, &command, sizeof(int))
+            && transport->send(transport, w, message, (size_t)numOfCents*dim*sizeof(double)),0);
+    }
+    for (w = 0; w < transport->numOfWorkers; w++) {
+        errorAssert(transport->receive(transport, w, counts, numOfCents*sizeof(int))
+            && transport->receive(transport, w, message, (size_t)numOfCents*(dim + 1)*sizeof(double)),0);
+        for (c = 0; c < numOfCents; c++) {
+            state->counts[c] = w == 0 ? counts[c] : state->counts[c] + counts[c];
+            state->mass[c] = w == 0 ? message[(size_t)numOfCents*dim+c]
+                : state->mass[c] + message[(size_t)numOfCents*dim+c];
+            for (j = 0; j < dim; j++) {
+                state->sums[c][j] = w == 0 ? message[(size_t)c*dim+j]
+                    : state->sums[c][j] + message[(size_t)c*dim+j];
             }
         }
     }
-    
-    res = malloc(2*sizeof(int));
-    res[0] = maxRow;
-    res[1] = maxCol;
-    return res; /*returns as a tuple (i,j)*/
+    updateCentroids(state);
+    free(counts);
+    free(message);
 }
 
-double calcTheta(double **matrix, int i, int j){
-    /*calcs theta as part os jacobi computations*/
-    return (matrix[j][j]-matrix[i][i])/(2*matrix[i][j]);
+void stopWorkers(kmeansState *state, kmeansTransport *transport) {
+    /*ends the workers and collects the labels of their last assignment*/
+    int w, from, to, command = KMEANS_STOP;
+    for (w = 0; w < transport->numOfWorkers; w++) {
+        errorAssert(transport->send(transport, w, &command, sizeof(int)),0);
+    }
+    for (w = 0; w < transport->numOfWorkers; w++) {
+        partitionRows(state->numOfPoints, transport->numOfWorkers, w, &from, &to);
+        errorAssert(transport->receive(transport, w, state->labels + from, (to - from)*sizeof(int)),0);
+    }
+    transport->stop(transport);
 }
 
-double calcT(double theta){
-    /*calcs t as part os jacobi computations*/
-    int sign = theta < 0 ? -1 : 1;
-    double denom = fabs(theta)+sqrt(pow(theta,2)+1);
-    return sign/denom;
+#ifndef _WIN32
+typedef struct localCluster {
+    int *sockets; /*coordinator ends, one per worker*/
+    pid_t *pids;
+    int own; /*the worker's end, in a worker*/
+} localCluster;
+
+int localMove(int fd, void *data, size_t size, int isSend) {
+    /*writes or reads all size bytes of a stream socket, 0 on EOF or error*/
+    char *bytes = (char *)data;
+    ssize_t done;
+    while (size > 0) {
+        done = isSend ? write(fd, bytes, size) : read(fd, bytes, size);
+        if (done <= 0) {
+            return 0;
+        }
+        bytes += done;
+        size -= (size_t)done;
+    }
+    return 1;
 }
 
-double calcC(double t){
-    /*calcs c as part os jacobi computations*/
-    return 1 / (sqrt(pow(t,2)+1));
+int localSend(kmeansTransport *transport, int peer, void *data, size_t size) {
+    localCluster *cluster = (localCluster *)transport->context;
+    return localMove(peer == KMEANS_COORDINATOR ? cluster->own : cluster->sockets[peer], data, size, 1);
 }
 
-double calcS(double t, double c){
-    /*calcs s as part os jacobi computations*/
-    return t*c;
+int localReceive(kmeansTransport *transport, int peer, void *data, size_t size) {
+    localCluster *cluster = (localCluster *)transport->context;
+    return localMove(peer == KMEANS_COORDINATOR ? cluster->own : cluster->sockets[peer], data, size, 0);
 }
 
-void createRotationMatrixP(double** P, int maxRow, int maxCol, double c, double s){
-    /*calcs P rotation matrix as part of jacobi computations*/
-    int i,j;
-    for (i = 0; i < numOfVectors; i++) { /*I matrix*/
-        for (j = 0; j < numOfVectors; j++) { 
-            P[i][j] = i==j ? 1 : 0;
+void localStart(kmeansTransport *transport, kmeansState *state) {
+    /*forks a worker per partition, each on its own socketpair. A worker
+    reads its rows from the pages it shares with the coordinator after
+    the fork, so nothing is copied to start it*/
+    int w, v, pair[2];
+    pid_t pid;
+    localCluster *cluster = (localCluster *)calloc(1, sizeof(localCluster));
+
+    errorAssert(cluster != NULL,0);
+    cluster->sockets = (int *)calloc(transport->numOfWorkers, sizeof(int));
+    cluster->pids = (pid_t *)calloc(transport->numOfWorkers, sizeof(pid_t));
+    errorAssert(cluster->sockets != NULL && cluster->pids != NULL,0);
+    transport->context = cluster;
+    fflush(stdout); /*or the workers would flush it again*/
+    for (w = 0; w < transport->numOfWorkers; w++) {
+        errorAssert(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0,0);
+        pid = fork();
+        errorAssert(pid >= 0,0);
+        if (pid == 0) {
+            inWorker = 1;
+            profiling = 0;
+            close(pair[0]);
+            for (v = 0; v < w; v++) { /*a worker only talks to the coordinator*/
+                close(cluster->sockets[v]);
+            }
+            cluster->own = pair[1];
+            transport->rank = w;
+            kmeansWorker(transport, state);
+            _exit(0);
         }
+        close(pair[1]);
+        cluster->sockets[w] = pair[0];
+        cluster->pids[w] = pid;
     }
-
-    P[maxRow][maxRow] = c;
-    P[maxCol][maxCol] = c;
-    P[maxRow][maxCol] = s;
-    P[maxCol][maxRow] = (-1)*s;
 }
 
-void updateAPrime(double** A, double** APrime, int i, int j, double c, double s){
-    /*gets A and A' and updates A' by five equations in instructions*/
-    int r;
-    for (r = 0; r < numOfVectors; r++){
-        if ((r!=i) && (r!=j)){
-            APrime[i][r] = APrime[r][i] = c*A[r][i]-s*A[r][j];
-            APrime[j][r] = APrime[r][j] = c*A[r][j]+s*A[r][i];
-        }
+void localStop(kmeansTransport *transport) {
+    /*closes the sockets and reaps the workers*/
+    int w;
+    localCluster *cluster = (localCluster *)transport->context;
+    for (w = 0; w < transport->numOfWorkers; w++) {
+        close(cluster->sockets[w]);
+        waitpid(cluster->pids[w], NULL, 0);
     }
-    APrime[i][i] = pow(c,2)*A[i][i]+pow(s,2)*A[j][j]-2*s*c*A[i][j];
-    APrime[j][j] = pow(s,2)*A[i][i]+pow(c,2)*A[j][j]+2*s*c*A[i][j];
-    APrime[i][j] = 0;
-    APrime[j][i] = 0;
+    free(cluster->sockets);
+    free(cluster->pids);
+    free(cluster);
+    transport->context = NULL;
 }
-
-double calcOffSquared(double** mat){
-    /*gets a matrix and calculates the sum of off-diagonal elements squared*/
-    int i,j;
-    double sum = 0;
-    for (i = 0; i < numOfVectors; i++){
-        for (j = 0; j < numOfVectors; j++){
-            if (i!=j){
-                sum += pow(mat[i][j],2);
-            }
-        }
-    }
-    return sum;
+#endif
+
+void localTransport(kmeansTransport *transport, int numOfWorkers) {
+    /*the transport of numOfWorkers forked workers on this host*/
+    transport->numOfWorkers = numOfWorkers;
+    transport->rank = KMEANS_COORDINATOR;
+    transport->context = NULL;
+#ifndef _WIN32
+    transport->start = localStart;
+    transport->send = localSend;
+    transport->receive = localReceive;
+    transport->stop = localStop;
+#else
+    errorAssert(0==1,1); /*no fork, --workers needs a POSIX build*/
+#endif
 }
 
-int checkConvergence(double** A, double** APrime){
-    /*gets A and A' matrixes and checks if their off values are closer than epsilon*/
-    double epsilon = pow(10,-15); /*constant from instructions*/
-    double a = calcOffSquared(A);
-    double ap = calcOffSquared(APrime);
-    
-    if ((a-ap)<=epsilon){
-        return 1;
-    }
-    return 0;
+int coresetSize(int n) {
+    /*number of representatives --coreset asks for, at least one*/
+    int size = (int)ceil(n*coresetRatio);
+    return size < 1 ? 1 : (size > n ? n : size);
 }
 
-void printJacobi(double **A, double **V) {
-    /*gets A matrix (for eigenvalues) and V matrix (for eigenvectors) 
-    and prints them according to instructions*/
-    int i,j;
+void buildCoreset(int size) {
+    /*replaces vectors with at most size weighted representatives. Centers
+    are picked farthest point first (deterministic, O(n*size*d)), every
+    point joins its nearest center and a representative is the mean of
+    its points, weighted by their count. Representatives are numbered by
+    their first point, so size n gives back vectors themselves*/
+    int i, j, c, far, numOfReps, *order;
+    double dis, *nearest, **reps;
+    double start = PROFILE_NOW();
+
+    numOfInputPoints = numOfVectors;
+    nearest = (double *)calloc(numOfVectors, sizeof(double));
+    coresetMap = (int *)calloc(numOfVectors, sizeof(int));
+    errorAssert(nearest != NULL && coresetMap != NULL,0);
     for (i = 0; i < numOfVectors; i++) {
-        if ((A[i][i]<0)&&(A[i][i]>-0.00005)){
-                A[i][i] = 0;
+        nearest[i] = vectorDistance(vectors[i], vectors[0], dimension);
+    }
+    for (numOfReps = 1; numOfReps < size; numOfReps++) {
+        for (i = 1, far = 0; i < numOfVectors; i++) {
+            far = nearest[i] > nearest[far] ? i : far;
         }
-        printf("%.4f", A[i][i]); /*eigenvalues, Format to 4 digits*/
-            if (i < numOfVectors - 1) {
-                printf(",");
+        if (nearest[far] == 0) { /*every point sits on a center already*/
+            break;
+        }
+        for (i = 0; i < numOfVectors; i++) {
+            dis = vectorDistance(vectors[i], vectors[far], dimension);
+            if (dis < nearest[i]) {
+                nearest[i] = dis;
+                coresetMap[i] = numOfReps;
             }
+        }
     }
-    printf("\n");
-    for (i = 0; i < numOfVectors; i++) {
-        for (j = 0; j < numOfVectors; j++) {
-            if ((V[j][i]<0)&&(V[j][i]>-0.00005)){
-                V[j][i] = 0;
-            }
-            printf("%.4f", V[j][i]); /*Transpose V, Format to 4 digits*/
-            if (j < numOfVectors - 1) {
-                printf(",");
-            }
+
+    order = (int *)calloc(numOfReps, sizeof(int));
+    pointWeights = (double *)calloc(numOfReps, sizeof(double));
+    reps = (double **)calloc(numOfReps, sizeof(double *));
+    errorAssert(order != NULL && pointWeights != NULL && reps != NULL,0);
+    for (c = 0; c < numOfReps; c++) {
+        order[c] = -1;
+    }
+    for (i = 0, c = 0; i < numOfVectors; i++) {
+        if (order[coresetMap[i]] < 0) { /*first point of this center*/
+            order[coresetMap[i]] = c;
+            reps[c] = (double *)calloc(dimension, sizeof(double));
+            errorAssert(reps[c] != NULL,0);
+            c++;
         }
-        if ( i < numOfVectors - 1) {
-            printf("\n");
+        coresetMap[i] = order[coresetMap[i]];
+        pointWeights[coresetMap[i]] += 1;
+        for (j = 0; j < dimension; j++) {
+            reps[coresetMap[i]][j] += vectors[i][j];
         }
     }
+    for (c = 0; c < numOfReps; c++) {
+        for (j = 0; j < dimension; j++) {
+            reps[c][j] /= pointWeights[c];
+        }
+    }
+    free(order);
+    free(nearest);
+    free2DDoubleArray(vectors, numOfVectors);
+    vectors = reps;
+    numOfVectors = numOfReps;
+    if (profiling) {
+        profileStage("coreset", start, numOfReps);
+        profileCount("coreset_size", numOfReps);
+    }
+}
+
+void printLabels() {
+    /*prints the cluster of every input point in one line, a point that
+    was reduced to a representative gets the representative's cluster*/
+    int i, numOfPoints = coresetMap != NULL ? numOfInputPoints : numOfVectors;
+
+    printf("\n");
+    for (i = 0; i < numOfPoints; i++) {
+        printf("%d%s", pointLabels[coresetMap != NULL ? coresetMap[i] : i],
+            i < numOfPoints - 1 ? "," : "");
+    }
+}
+
+void* arenaAlloc(size_t bytes) {
+    /*takes a zeroed block from the first free arena block that fits,
+    returns NULL when there is no arena or no block is large enough*/
+    int i, j;
+    size_t offset;
+    arenaBlock *block;
+
+    bytes = ARENA_ROUND(bytes);
+    for (i = 0; i < arena.numOfBlocks; i++) {
+        block = &arena.blocks[i];
+        if (block->used || block->size < bytes) {
+            continue;
+        }
+        if (block->size > bytes) { /*splits off the unused tail*/
+            errorAssert(arena.numOfBlocks < ARENA_MAX_BLOCKS,0);
+            for (j = arena.numOfBlocks; j > i + 1; j--) {
+                arena.blocks[j] = arena.blocks[j-1];
+            }
+            arena.blocks[i+1].offset = block->offset + bytes;
+            arena.blocks[i+1].size = block->size - bytes;
+            arena.blocks[i+1].used = 0;
+            arena.numOfBlocks++;
+            block->size = bytes;
+        }
+        block->used = 1;
+        offset = block->offset;
+        if (offset < arena.clean) { /*past clean the arena was never handed out*/
+            memset(arena.base + offset, 0,
+                (offset + bytes < arena.clean ? offset + bytes : arena.clean) - offset);
+        }
+        if (offset + bytes > arena.clean) {
+            arena.clean = offset + bytes;
+        }
+        return arena.base + offset;
+    }
+    return NULL;
+}
+
+int arenaFree(void *ptr) {
+    /*returns a block to the arena and merges it with free neighbours,
+    returns 0 when ptr is not an arena block*/
+    int i, j;
+    arenaBlock *blocks = arena.blocks;
+
+    if (arena.base == NULL || (char *)ptr < arena.base
+        || (char *)ptr >= arena.base + arena.size) {
+        return 0;
+    }
+    for (i = 0; i < arena.numOfBlocks && arena.base + blocks[i].offset != (char *)ptr; i++);
+    errorAssert(i < arena.numOfBlocks && blocks[i].used,0);
+    blocks[i].used = 0;
+    if (i + 1 < arena.numOfBlocks && !blocks[i+1].used) {
+        blocks[i].size += blocks[i+1].size;
+        for (j = i + 1; j < arena.numOfBlocks - 1; j++) {
+            blocks[j] = blocks[j+1];
+        }
+        arena.numOfBlocks--;
+    }
+    if (i > 0 && !blocks[i-1].used) {
+        blocks[i-1].size += blocks[i].size;
+        for (j = i; j < arena.numOfBlocks - 1; j++) {
+            blocks[j] = blocks[j+1];
+        }
+        arena.numOfBlocks--;
+    }
+    return 1;
+}
+
+void reserveWorkspace(size_t bytes) {
+    /*allocates the arena the large buffers of a goal are taken from, its
+    size comes from planWorkspace so every stage fits without a fallback*/
+    releaseWorkspace();
+    if (bytes == 0) {
+        return;
+    }
+    arena.base = (char *)allocBlock(bytes);
+    arena.size = bytes;
+    arena.clean = 0;
+    arena.numOfBlocks = 1;
+    arena.blocks[0].offset = 0;
+    arena.blocks[0].size = bytes;
+    arena.blocks[0].used = 0;
+}
+
+void releaseWorkspace() {
+    /*frees the arena, its blocks must not be used afterwards*/
+    if (arena.base != NULL) {
+        freeBlock(arena.base);
+    }
+    arena.base = NULL;
+    arena.size = 0;
+    arena.numOfBlocks = 0;
+}
+
+size_t planWorkspace(char *planGoal, size_t *heapBytes) {
+    /*predicts the arena bytes a goal needs from n, d, k and the options,
+    following the allocation order of its stages (first fit), heapBytes
+    gets an upper bound of everything else the goal allocates*/
+    size_t n = numOfVectors, d = dimension, m = numOfLandmarks;
+    size_t kMax, workers, inFlight, heap, bytes = 0;
+    int i, numOfKs, *ks;
+
+    /*vectors as read, with the doubling row array of readFile*/
+    heap = n*d*sizeof(double) + 2*n*sizeof(double *);
+    if (coresetRatio > 0) { /*spk runs on the representatives from here*/
+        heap += 2*n*sizeof(int) + n*sizeof(double);
+        n = (size_t)coresetSize(numOfVectors);
+        heap += n*(d*sizeof(double) + sizeof(double *) + 2*sizeof(double));
+    }
+    if (strcmp(planGoal,"wam")==0) {
+        bytes = ARENA_ROUND(n*(n+1)/2*sizeof(double));
+        heap += n*sizeof(double *) + (pipelineIngest || graphPath != NULL ? n*sizeof(double) : 0);
+    }
+    else if (strcmp(planGoal,"ddg")==0) {
+        heap += n*sizeof(double);
+        if (graphPath != NULL) { /*wam is built to sum the degrees and saved*/
+            bytes = ARENA_ROUND(n*(n+1)/2*sizeof(double));
+            heap += n*sizeof(double *);
+        }
+        else if (pipelineIngest) { /*the wam rows of blocks taken but not yet folded*/
+            workers = numOfThreads > 0 ? numOfThreads : defaultNumOfThreads();
+            inFlight = 2*workers*DEGREE_TILE*n; /*a worker's block, and one waiting to fold*/
+            heap += n*sizeof(double *) + (inFlight < n*(n+1)/2 ? inFlight : n*(n+1)/2)*sizeof(double);
+        }
+    }
+    else if (strcmp(planGoal,"lnorm")==0) {
+        bytes = ARENA_ROUND(n*(n+1)/2*sizeof(double));
+        heap += n*sizeof(double *) + n*sizeof(double);
+    }
+    else if (strcmp(planGoal,"jacobi")==0) {
+        /*the packed input, rotated in place, then V*/
+        bytes = ARENA_ROUND(n*(n+1)/2*sizeof(double)) + ARENA_ROUND(n*n*sizeof(double));
+        heap += 2*n*sizeof(double *);
+        if (warmPath != NULL) { /*the product of rotateIntoBasis, after V*/
+            bytes += ARENA_ROUND(n*n*sizeof(double));
+            heap += n*sizeof(double *);
+        }
+        if (checkpointPath != NULL) { /*the snapshot, and A as read on a resume*/
+            heap += (n*(n+1) + n*n)*sizeof(double) + 2*n*(sizeof(double *) + sizeof(size_t));
+        }
+    }
+    else if (strcmp(planGoal,"spk")==0 || strcmp(planGoal,"sweep")==0) {
+        if (m > 0) { /*C, landmark A, landmark V, then V (n x m) at the end*/
+            bytes = ARENA_ROUND(n*m*sizeof(spkReal)) + ARENA_ROUND(m*(m+1)/2*sizeof(double))
+                + ARENA_ROUND(m*m*sizeof(double)) + ARENA_ROUND(n*m*sizeof(double));
+            heap += n*sizeof(double) + m*sizeof(int) + (n + 2*m)*sizeof(double *);
+            heap += (m*m + 2*m)*sizeof(double); /*the landmark model kept for predict*/
+        }
+        else { /*lnorm, rotated in place, then V (n x n) while both are alive*/
+            bytes = ARENA_ROUND(n*(n+1)/2*sizeof(double)) + ARENA_ROUND(n*n*sizeof(double));
+            heap += 2*n*sizeof(double *);
+            m = n;
+        }
+        if (warmPath != NULL) { /*the product of rotateIntoBasis, after V*/
+            bytes += ARENA_ROUND(m*m*sizeof(double));
+            heap += m*sizeof(double *);
+        }
+        if (checkpointPath != NULL) { /*the snapshot, and A as read on a resume*/
+            heap += (m*(m+1) + m*m)*sizeof(double) + 2*m*(sizeof(double *) + sizeof(size_t));
+        }
+        /*degrees, eigenvalues, gaps and the sorted eigenvector order*/
+        heap += n*sizeof(double) + m*(sizeof(double) + sizeof(eigenVector)) + m/2*sizeof(double);
+        kMax = k > 0 ? (size_t)k : m/2;
+        workers = 1;
+        if (strcmp(planGoal,"sweep")==0) {
+            numOfKs = (int)kMax;
+            if (sweepKs != NULL) {
+                ks = parseKList(sweepKs, &numOfKs);
+                for (i = 0, kMax = 0; i < numOfKs; i++) {
+                    kMax = (size_t)ks[i] > kMax ? (size_t)ks[i] : kMax;
+                }
+                free(ks);
+            }
+            workers = numOfThreads > 0 ? numOfThreads : defaultNumOfThreads();
+            workers = workers > (size_t)numOfKs ? (size_t)numOfKs : workers;
+            heap += numOfKs*kMax*kMax*sizeof(double); /*centroids of every k*/
+        }
+        /*per kmeans run: T (or U), the packed point copy and the labels*/
+        heap += workers*(n*(kMax*sizeof(double) + sizeof(double *))
+            + n*kMax*sizeof(spkReal) + n*sizeof(int) + 3*kMax*kMax*sizeof(double));
+    }
+    if (heapBytes != NULL) {
+        *heapBytes = heap;
+    }
+    return bytes;
+}
+
+void* allocBlock(size_t bytes) {
+    /*allocates bytes zeroed bytes, backed by an unlinked scratch file in
+    scratchDir when one is set so the page cache can evict it instead of
+    the process running out of memory*/
+    void *block;
+#ifndef _WIN32
+    char path[EIGEN_CACHE_PATH_LEN];
+    int i, fd;
+
+    if (scratchDir != NULL && bytes > 0) {
+        for (i = 0; i < SCRATCH_MAX_BLOCKS && scratchMaps[i] != NULL; i++);
+        errorAssert(i < SCRATCH_MAX_BLOCKS,0);
+        errorAssert(strlen(scratchDir) + 32 < EIGEN_CACHE_PATH_LEN,1);
+        sprintf(path, "%s/spkmeans-scratch-XXXXXX", scratchDir);
+        fd = mkstemp(path);
+        errorAssert(fd >= 0,0);
+        unlink(path); /*the file goes away with the mapping*/
+        errorAssert(ftruncate(fd, (off_t)bytes) == 0,0); /*sparse, reads as zeros*/
+        block = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        errorAssert(block != MAP_FAILED,0);
+        /*no access advice: jacobi's rotations touch rows i and j of A and
+        one entry in every later row, readahead would only evict pages*/
+        scratchMaps[i] = block;
+        scratchSizes[i] = bytes;
+        return block;
+    }
+#endif
+    block = calloc(bytes, 1);
+    errorAssert(block != NULL || bytes == 0,0);
+    return block;
+}
+
+void freeBlock(void *block) {
+    /*releases a buffer made by allocBlock*/
+#ifndef _WIN32
+    int i;
+    for (i = 0; i < SCRATCH_MAX_BLOCKS; i++) {
+        if (block != NULL && scratchMaps[i] == block) {
+            munmap(block, scratchSizes[i]);
+            scratchMaps[i] = NULL;
+            return;
+        }
+    }
+#endif
+    free(block);
+}
+
+void* allocLarge(size_t count, size_t size) {
+    /*allocates count zeroed elements of size bytes for an n x n sized
+    buffer, from the workspace arena when it has room*/
+    void *block = arenaAlloc(count*size);
+    return block != NULL ? block : allocBlock(count*size);
+}
+
+void freeLarge(void *block) {
+    /*releases a buffer made by allocLarge*/
+    if (!arenaFree(block)) {
+        freeBlock(block);
+    }
+}
+
+double** allocDenseMatrix(int numOfRows, int numOfCols) {
+    /*allocates a zeroed matrix whose rows share one allocLarge block*/
+    int i;
+    double *data, **mat;
+    data = (double *)allocLarge((size_t)numOfRows*numOfCols, sizeof(double));
+    mat = (double **)calloc(numOfRows, sizeof(double *));
+    errorAssert(mat != NULL,0);
+    for (i = 0; i < numOfRows; i++) {
+        mat[i] = data + (size_t)i*numOfCols;
+    }
+    return mat;
+}
+
+void freeDenseMatrix(double **mat) {
+    /*frees a matrix made by allocDenseMatrix, NULL safe*/
+    if (mat == NULL) {
+        return;
+    }
+    freeLarge(mat[0]);
+    free(mat);
+}
+
+void allocSymMatrix(symMatrix *mat, int n) {
+    /*allocates a zeroed symmetric n x n matrix, only the lower triangle
+    (n(n+1)/2 entries) is stored, row after row*/
+    int i;
+    size_t offset = 0;
+    mat->n = n;
+    mat->data = (double *)allocLarge((size_t)n*(n+1)/2, sizeof(double));
+    mat->rows = (double **)calloc(n, sizeof(double *));
+    errorAssert(mat->rows != NULL,0);
+    for (i = 0; i < n; i++) {
+        mat->rows[i] = mat->data + offset; /*row i holds entries (i,0..i)*/
+        offset += i + 1;
+    }
+}
+
+void freeSymMatrix(symMatrix *mat) {
+    /*frees a symmetric matrix, safe to call twice*/
+    freeLarge(mat->data);
+    free(mat->rows);
+    mat->data = NULL;
+    mat->rows = NULL;
+}
+
+void squareToSymMatrix(double **square, symMatrix *mat, int n) {
+    /*packs the lower triangle of a symmetric square matrix*/
+    int i, j;
+    allocSymMatrix(mat, n);
+    for (i = 0; i < n; i++) {
+        for (j = 0; j <= i; j++) {
+            mat->rows[i][j] = square[i][j];
+        }
+    }
+}
+
+void printMatrix(double** mat, int numOfRows, int numOfCols) {
+    /*prints a matrix*/
+    int i, j;
+    for (i = 0; i < numOfRows; i++) {
+        for (j = 0; j < numOfCols; j++) {
+            if ((mat[i][j]<0)&&(mat[i][j]>-0.00005)){
+                mat[i][j] = 0;
+            }
+            printf("%.4f", mat[i][j]); /*format the floats precision to 4 digits*/
+            if (j < numOfCols - 1) {
+                printf(",");
+            }
+        }
+        if (i < numOfRows - 1) {
+            printf("\n");
+        }
+    }
+}
+
+void printSymMatrix(symMatrix *mat) {
+    /*prints a symmetric matrix in full, both triangles*/
+    int i, j;
+    double val;
+    for (i = 0; i < mat->n; i++) {
+        for (j = 0; j < mat->n; j++) {
+            val = SYM_ENTRY(mat, i, j);
+            if ((val<0)&&(val>-0.00005)){
+                val = 0;
+            }
+            printf("%.4f", val); /*format the floats precision to 4 digits*/
+            if (j < mat->n - 1) {
+                printf(",");
+            }
+        }
+        if (i < mat->n - 1) {
+            printf("\n");
+        }
+    }
+}
+
+double** matrixMultiplication(double** a, double** b){
+    /*gets two matrixes and multiplies them*/
+    int i,j,k;
+    double** mul = (double **)calloc(numOfVectors, numOfVectors*sizeof(double));
+    errorAssert(mul != NULL,0);
+    for (i = 0; i < numOfVectors; i++) {
+        mul[i] = (double *)calloc(numOfVectors, sizeof(double));
+        errorAssert(mul[i] != NULL,0);
+    }
+
+    for(i = 0; i < numOfVectors; i++){    
+        for(j = 0; j < numOfVectors; j++){    
+            mul[i][j]=0;    
+            for(k = 0; k < numOfVectors; k++){
+                /*by matrixes multiplication rules*/    
+                mul[i][j] += a[i][k] * b[k][j];     
+            }    
+        }    
+    } 
+    return mul;   
+}
+
+void squareMatrixTranspose(double **matrix, int numOfRows) {
+    /*transpose a squared matrix*/
+    int i,j;
+    double tmp;
+    for (i = 1; i < numOfRows; i++) {
+        for (j = 0; j < i; j++) {
+            tmp = matrix[i][j];
+            matrix[i][j] = matrix[j][i];
+            matrix[j][i] = tmp;
+        }
+    }
+}
+
+double calcWeightsForAdjacencyMatrix(double *vector1, double *vector2){
+    /*gets two vectors and calculates wij for them*/
+    double dis;
+    /*the euclidean distance between two vectors, by the kernel for dimension*/
+    dis = DISTANCE_KERNEL(affinityKernels, dimension)(vector1, vector2, dimension);
+    dis = sqrt(dis); /*added factors according to instructions*/
+    dis = -0.5*dis; /*added factors according to instructions*/
+    
+    return exp(dis);
+} 
+
+symMatrix* weightedAdjacencyMatrix(){
+    /*calculates weighted adjacency matrix after vectors matrix was set up*/
+    int i, j;
+    double start = PROFILE_NOW();
+
+    if (graphIngested) { /*already built while the file was read*/
+        return &wam;
+    }
+    allocSymMatrix(&wam, numOfVectors); /*wam is symetric, zeros on the diagonal*/
+    for (i = 0; i < numOfVectors; i++){
+        double* vector1 = vectors[i]; /*gets vector i*/
+        for (j = 0; j < i; j++){ 
+            double* vector2 = vectors[j]; /*gets vector j*/
+            wam.rows[i][j] = calcWeightsForAdjacencyMatrix(vector2, vector1);
+        }
+    }
+
+    PROFILE_STAGE("wam", start, 0);
+    return &wam;
+}
+
+void degreeRowSums(double *degrees){
+    /*streams the row sums of wam tile by tile without storing wam. Only
+    the tiles on and below the diagonal are visited and each affinity is
+    added to both of its rows, yet with the tiles in row order every row
+    is still summed in column order, so the sums match wam's rows.
+    With pointWeights, w_i*w_j*W_ij plus the w_i*(w_i-1) pairs of points
+    that share representative i*/
+    int i, j, rowTile, colTile, rowEnd, colEnd;
+    double w;
+
+    for (i = 0; i < numOfVectors; i++) {
+        degrees[i] = 0;
+    }
+    for (rowTile = 0; rowTile < numOfVectors; rowTile += DEGREE_TILE) {
+        rowEnd = rowTile + DEGREE_TILE < numOfVectors ? rowTile + DEGREE_TILE : numOfVectors;
+        for (colTile = 0; colTile <= rowTile; colTile += DEGREE_TILE) {
+            colEnd = colTile + DEGREE_TILE < numOfVectors ? colTile + DEGREE_TILE : numOfVectors;
+            for (i = rowTile; i < rowEnd; i++) {
+                for (j = colTile; j < colEnd && j < i; j++) { /*wam has zeros on the diagonal*/
+                    w = calcWeightsForAdjacencyMatrix(vectors[i], vectors[j]);
+                    if (pointWeights != NULL) {
+                        w = pointWeights[i]*pointWeights[j]*w;
+                    }
+                    degrees[i] += w;
+                    degrees[j] += w;
+                }
+            }
+        }
+    }
+    for (i = 0; pointWeights != NULL && i < numOfVectors; i++) {
+        degrees[i] += pointWeights[i]*(pointWeights[i] - 1);
+    }
+}
+
+double* diagonalDegreeMatrix(int toPrint){
+    /*calculates the diagonal of the diagonal degree matrix, O(n) memory*/
+    int i;
+    double start = PROFILE_NOW();
+
+    if (ddg == NULL) { /*else they were summed with wam, see graphRows*/
+        ddg = (double *)calloc(numOfVectors, sizeof(double));
+        errorAssert(ddg != NULL,0);
+        degreeRowSums(ddg);
+    }
+
+    if (toPrint==0){ /*if was called for further calculations*/
+        for (i = 0; i < numOfVectors; i++) {
+            ddg[i] = 1/sqrt(ddg[i]);
+        }
+    }
+    PROFILE_STAGE("ddg", start, 0);
+    return ddg;
+} 
+
+void printDiagonalMatrix(double *diag, int numOfRows) {
+    /*prints a diagonal matrix given by its diagonal, like printMatrix*/
+    int i, j;
+    for (i = 0; i < numOfRows; i++) {
+        for (j = 0; j < numOfRows; j++) {
+            if (i == j) {
+                if ((diag[i]<0)&&(diag[i]>-0.00005)){
+                    diag[i] = 0;
+                }
+                printf("%.4f", diag[i]); /*format the floats precision to 4 digits*/
+            }
+            else {
+                printf("0.0000");
+            }
+            if (j < numOfRows - 1) {
+                printf(",");
+            }
+        }
+        if (i < numOfRows - 1) {
+            printf("\n");
+        }
+    }
+}
+
+symMatrix* laplacianNorm(){
+    /*calculated the laplacian norm matrix, I - D^-0.5 W D^-0.5. W goes
+    into the packed storage once (as the ingest builds it), the degrees are
+    summed from it and it is scaled in place, so every affinity is computed
+    once and the degree matrix is never stored as an n x n matrix*/
+    int i,j;
+    double start = PROFILE_NOW(), stageStart;
+
+    if (!graphIngested) {
+        stageStart = PROFILE_NOW();
+        ddg = (double *)calloc(numOfVectors, sizeof(double));
+        errorAssert(ddg != NULL,0);
+        allocSymMatrix(&wam, numOfVectors);
+        graphRows(wam.rows, 0, numOfVectors);
+        foldRows(wam.rows, 0, numOfVectors);
+        for (i = 0; pointWeights != NULL && i < numOfVectors; i++) {
+            ddg[i] += pointWeights[i]*(pointWeights[i] - 1); /*see degreeRowSums*/
+        }
+        PROFILE_STAGE("wam", stageStart, 0);
+    }
+    ddg = diagonalDegreeMatrix(0); /*D^-0.5 of the raw degrees*/
+
+    lnorm = wam;
+    wam.rows = NULL;
+    wam.data = NULL;
+    for (i = 0; i < numOfVectors; i++){
+        for (j = 0; j < i; j++){
+            lnorm.rows[i][j] = (-1)*((ddg[j]*lnorm.rows[i][j])*ddg[i]); /*I - matrix*/
+        }
+        lnorm.rows[i][i] = 1; /*I - matrix, wam has zeros on the diagonal*/
+        if (pointWeights != NULL) { /*unless points share representative i*/
+            lnorm.rows[i][i] -= ddg[i]*pointWeights[i]*(pointWeights[i] - 1)*ddg[i];
+        }
+    }
+    PROFILE_STAGE("lnorm", start, 0);
+    return &lnorm;
+}
+
+void measureFile(FILE *file, int *numOfRows, int *numOfCols) {
+    /*counts the rows of a csv file the way readVectors reads them and gets
+    the dimension from the first line, then rewinds. Newline counting is
+    much cheaper than parsing, and the pipeline needs n up front*/
+    char chunk[READ_BUFFER_SIZE], *buffer, last = '\n';
+    size_t i, len, bufferSize = READ_BUFFER_SIZE;
+    int rows = 0;
+
+    errorAssert(file != NULL,1);
+    buffer = (char *)malloc(bufferSize);
+    errorAssert(buffer != NULL,0);
+    errorAssert(readLine(file, &buffer, &bufferSize) != NULL,0);
+    *numOfCols = calcDimension(buffer);
+    free(buffer);
+    rewind(file);
+    while ((len = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        for (i = 0; i < len; i++) {
+            rows += chunk[i] == '\n';
+        }
+        last = chunk[len - 1];
+    }
+    *numOfRows = rows + (last != '\n'); /*the last line may have no newline*/
+    rewind(file);
+}
+
+void graphRows(double **rows, int from, int to) {
+    /*wam rows from..to-1 into rows (wam.rows, or a block's own buffer),
+    every earlier point is already read. ddg[i] gets the sum of row i
+    left of the diagonal, in column order*/
+    int i, j;
+    double w, sum;
+
+    for (i = from; i < to; i++) {
+        sum = 0;
+        for (j = 0; j < i; j++) {
+            w = calcWeightsForAdjacencyMatrix(vectors[j], vectors[i]);
+            if (pointWeights != NULL) { /*see degreeRowSums*/
+                w *= pointWeights[i]*pointWeights[j];
+            }
+            rows[i][j] = w;
+            sum += w;
+        }
+        ddg[i] = sum;
+    }
+}
+
+void foldRows(double **rows, int from, int to) {
+    /*adds wam rows from..to-1 to the degrees of the points above the
+    diagonal. Rows are folded in order, so every degree is summed in
+    column order like degreeRowSums and the results are bit-identical*/
+    int i, j;
+
+    for (j = from; j < to; j++) {
+        for (i = 0; i < j; i++) {
+            ddg[i] += rows[j][i];
+        }
+    }
+}
+
+int blockEnd(int block) {
+    /*end of a DEGREE_TILE block of rows*/
+    int end = (block + 1)*DEGREE_TILE;
+    return end < numOfVectors ? end : numOfVectors;
+}
+
+void graphBlock(double **rows, int block, int isKept) {
+    /*the wam rows of a read block. When wam is not kept (the ddg goal)
+    they get a buffer of their own that foldBlock frees, so only the
+    blocks in flight are held instead of the whole triangle*/
+    int i, from = block*DEGREE_TILE, to = blockEnd(block);
+    size_t offset = 0;
+    double *data;
+
+    if (!isKept) {
+        data = (double *)malloc(((size_t)(from + to - 1)*(to - from)/2 + 1)*sizeof(double));
+        errorAssert(data != NULL,0);
+        for (i = from; i < to; i++) {
+            rows[i] = data + offset; /*row i holds entries (i,0..i-1)*/
+            offset += i;
+        }
+    }
+    graphRows(rows, from, to);
+}
+
+void foldBlock(double **rows, int block, int isKept) {
+    /*adds a computed block to the degrees above it, blocks in order*/
+    foldRows(rows, block*DEGREE_TILE, blockEnd(block));
+    if (!isKept) {
+        free(rows[block*DEGREE_TILE]);
+    }
+}
+
+#ifdef SPK_THREADS
+typedef struct ingestQueue {
+    int pushed, taken, folded, numOfBlocks, closed, folding, isKept;
+    int *done;
+    double **rows; /*wam.rows when wam is kept*/
+    pthread_mutex_t lock;
+    pthread_cond_t ready, space;
+} ingestQueue;
+
+void* ingestWorker(void *arg) {
+    /*computes the wam tiles of the next read block, then folds the
+    finished blocks in order unless another worker already is*/
+    ingestQueue *queue = (ingestQueue *)arg;
+    int block;
+    while (1) {
+        pthread_mutex_lock(&queue->lock);
+        while (queue->taken == queue->pushed && !queue->closed) {
+            pthread_cond_wait(&queue->ready, &queue->lock);
+        }
+        if (queue->taken == queue->pushed) {
+            pthread_mutex_unlock(&queue->lock);
+            break;
+        }
+        block = queue->taken++;
+        pthread_cond_signal(&queue->space);
+        pthread_mutex_unlock(&queue->lock);
+
+        graphBlock(queue->rows, block, queue->isKept);
+
+        pthread_mutex_lock(&queue->lock);
+        queue->done[block] = 1;
+        if (!queue->folding) {
+            queue->folding = 1;
+            while (queue->folded < queue->numOfBlocks && queue->done[queue->folded]) {
+                block = queue->folded;
+                pthread_mutex_unlock(&queue->lock);
+                foldBlock(queue->rows, block, queue->isKept);
+                pthread_mutex_lock(&queue->lock);
+                queue->folded++;
+            }
+            queue->folding = 0;
+        }
+        pthread_mutex_unlock(&queue->lock);
+    }
+    return NULL;
+}
+#endif
+
+void ingestPipelined(FILE *file) {
+    /*reads the numOfVectors rows measureFile counted and hands every
+    DEGREE_TILE of them through a bounded queue to workers, which build
+    the wam rows and degree sums of the block while the next one is
+    parsed. Leaves wam and the raw degrees in ddg (graphIngested), the
+    ddg goal only the degrees*/
+    int i, rows = 0, numOfBlocks, numOfWorkers, isKept = strcmp(goal,"ddg")!=0;
+    size_t bufferSize = READ_BUFFER_SIZE;
+    char *buffer;
+    double start = PROFILE_NOW(), **wamRows;
+#ifdef SPK_THREADS
+    ingestQueue queue;
+    pthread_t *workers = NULL;
+#endif
+
+    numOfBlocks = (numOfVectors + DEGREE_TILE - 1) / DEGREE_TILE;
+    numOfWorkers = numOfThreads > 0 ? numOfThreads : defaultNumOfThreads();
+    numOfWorkers = numOfWorkers < numOfBlocks ? numOfWorkers : numOfBlocks;
+    vectors = (double **)calloc(numOfVectors, sizeof(double *));
+    ddg = (double *)calloc(numOfVectors, sizeof(double));
+    buffer = (char *)malloc(bufferSize);
+    errorAssert(vectors != NULL && ddg != NULL && buffer != NULL,0);
+    if (isKept) {
+        allocSymMatrix(&wam, numOfVectors);
+        wamRows = wam.rows;
+    }
+    else { /*rows of the blocks in flight, see graphBlock*/
+        wamRows = (double **)calloc(numOfVectors, sizeof(double *));
+        errorAssert(wamRows != NULL,0);
+    }
+#ifdef SPK_THREADS
+    queue.pushed = queue.taken = queue.folded = queue.closed = queue.folding = 0;
+    queue.numOfBlocks = numOfBlocks;
+    queue.rows = wamRows;
+    queue.isKept = isKept;
+    queue.done = (int *)calloc(numOfBlocks + 1, sizeof(int));
+    errorAssert(queue.done != NULL,0);
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.ready, NULL);
+    pthread_cond_init(&queue.space, NULL);
+    workers = (pthread_t *)calloc(numOfWorkers + 1, sizeof(pthread_t));
+    errorAssert(workers != NULL,0);
+    for (i = 0; i < numOfWorkers; i++) {
+        errorAssert(pthread_create(&workers[i], NULL, ingestWorker, &queue) == 0,0);
+    }
+#endif
+
+    while (readLine(file, &buffer, &bufferSize) != NULL) {
+        errorAssert(rows < numOfVectors,1);
+        vectors[rows] = parseVector(buffer, dimension);
+        rows++;
+        if (rows % DEGREE_TILE != 0 && rows != numOfVectors) {
+            continue;
+        }
+#ifdef SPK_THREADS
+        pthread_mutex_lock(&queue.lock); /*wait for room, then publish the block*/
+        while (queue.pushed - queue.taken >= PIPELINE_QUEUE_BLOCKS) {
+            pthread_cond_wait(&queue.space, &queue.lock);
+        }
+        queue.pushed++;
+        pthread_cond_signal(&queue.ready);
+        pthread_mutex_unlock(&queue.lock);
+#else
+        graphBlock(wamRows, (rows - 1) / DEGREE_TILE, isKept);
+        foldBlock(wamRows, (rows - 1) / DEGREE_TILE, isKept);
+#endif
+    }
+    errorAssert(rows == numOfVectors,1);
+    free(buffer);
+    PROFILE_STAGE("parse", start, numOfVectors); /*reading ends before the wam*/
+
+#ifdef SPK_THREADS
+    pthread_mutex_lock(&queue.lock);
+    queue.closed = 1;
+    pthread_cond_broadcast(&queue.ready);
+    pthread_mutex_unlock(&queue.lock);
+    for (i = 0; i < numOfWorkers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    free(queue.done);
+    pthread_cond_destroy(&queue.space);
+    pthread_cond_destroy(&queue.ready);
+    pthread_mutex_destroy(&queue.lock);
+#else
+    (void)i;
+#endif
+    if (!isKept) {
+        free(wamRows);
+    }
+    graphIngested = 1;
+    PROFILE_STAGE("wam", start, numOfBlocks);
+}
+
+int loadGraph(char *path) {
+    /*reads a graph saved by saveGraph for a prefix of the current vectors
+    into wam and ddg, returns how many rows it covers (0 when the file is
+    missing or was saved for other points). file layout: header, the raw
+    degrees, then wam's packed lower triangle, row after row*/
+    unsigned int hash[2], params[2], header[GRAPH_HEADER];
+    int numOfRows = 0;
+    size_t entries;
+    FILE *file = fopen(path, "rb");
+
+    if (file == NULL) {
+        return 0;
+    }
+    if (fread(header, sizeof(unsigned int), GRAPH_HEADER, file) == GRAPH_HEADER
+        && header[0] == GRAPH_MAGIC && header[1] == GRAPH_VERSION
+        && header[2] <= (unsigned int)numOfVectors && header[3] == (unsigned int)dimension) {
+        params[0] = header[2];
+        params[1] = header[3];
+        hashRows(hash, params, 2, (int)header[2]);
+        if (header[4] == hash[0] && header[5] == hash[1]) { /*same points, appended to*/
+            numOfRows = (int)header[2];
+            entries = (size_t)numOfRows*(numOfRows+1)/2; /*rows 0..n-1 are contiguous*/
+            if (fread(ddg, sizeof(double), numOfRows, file) != (size_t)numOfRows
+                || fread(wam.data, sizeof(double), entries, file) != entries) {
+                numOfRows = 0;
+            }
+        }
+    }
+    fclose(file);
+    return numOfRows;
+}
+
+void saveGraph(char *path) {
+    /*writes wam and the raw degrees for the next incremental run, failures
+    are ignored since the file is only an optimization*/
+    unsigned int hash[2], header[GRAPH_HEADER];
+    char tmpPath[EIGEN_CACHE_PATH_LEN];
+    FILE *file;
+
+    errorAssert(strlen(path) + 4 < EIGEN_CACHE_PATH_LEN,1);
+    sprintf(tmpPath, "%s.tmp", path);
+    file = fopen(tmpPath, "wb");
+    if (file == NULL) {
+        return;
+    }
+    header[0] = GRAPH_MAGIC;
+    header[1] = GRAPH_VERSION;
+    header[2] = (unsigned int)numOfVectors;
+    header[3] = (unsigned int)dimension;
+    hashRows(hash, header + 2, 2, numOfVectors);
+    header[4] = hash[0];
+    header[5] = hash[1];
+    header[6] = header[7] = 0; /*reserved, keeps the data 8-byte aligned*/
+    fwrite(header, sizeof(unsigned int), GRAPH_HEADER, file);
+    fwrite(ddg, sizeof(double), numOfVectors, file);
+    fwrite(wam.data, sizeof(double), (size_t)numOfVectors*(numOfVectors+1)/2, file);
+    if (fclose(file) == 0) {
+        rename(tmpPath, path); /*readers never see a partial file*/
+    }
+    else {
+        remove(tmpPath);
+    }
+}
+
+void updateGraph(char *path) {
+    /*loads the graph of the points seen before and computes only the rows
+    of the appended ones, O(n*m*d) for m new points instead of O(n^2*d).
+    The old degrees are extended in column order, so the results are
+    bit-identical to building the graph from scratch. Leaves wam and the
+    raw degrees in ddg (graphIngested) and saves them back*/
+    int from;
+    double start = PROFILE_NOW();
+
+    allocSymMatrix(&wam, numOfVectors);
+    ddg = (double *)calloc(numOfVectors, sizeof(double));
+    errorAssert(ddg != NULL,0);
+    from = loadGraph(path);
+    graphRows(wam.rows, from, numOfVectors);
+    foldRows(wam.rows, from, numOfVectors);
+    graphIngested = 1;
+    if (from < numOfVectors) {
+        saveGraph(path);
+    }
+    if (profiling) {
+        profileStage("graph", start, numOfVectors - from);
+        profileCount("graph_reused_rows", from);
+    }
+}
+
+int* maxOffDiagonalValue(symMatrix *mat){
+    /*calculates the indexes of max off-diagonal element in a matrix, the
+    lower triangle is scanned but ties go to the first element of the
+    upper triangle in row order, as (i,j) with i<j. NULL when n < 2,
+    there is no off-diagonal element to pivot on*/
+    int i,j;
+    int maxRow = 0;
+    int maxCol = 1; /*initialized as the first off-diagonal element*/
+    int* res;
+    double val, maxVal;
+
+    if (mat->n < 2) {
+        return NULL;
+    }
+    maxVal = fabs(mat->rows[1][0]);
+
+    for (i = 1; i < mat->n; i++){
+        for (j = 0; j < i; j++){
+            /*finds the max off-diagonal element, (i,j) is (j,i) upper*/
+            val = fabs(mat->rows[i][j]);
+            if ((val>maxVal) || ((val==maxVal) && ((j<maxRow) || ((j==maxRow) && (i<maxCol))))){ 
+                maxVal = val;
+                maxRow = j;
+                maxCol = i;
+            }
+        }
+    }
+    
+    res = malloc(2*sizeof(int));
+    res[0] = maxRow;
+    res[1] = maxCol;
+    return res; /*returns as a tuple (i,j)*/
+}
+
+double calcTheta(symMatrix *matrix, int i, int j){
+    /*calcs theta as part os jacobi computations*/
+    return (matrix->rows[j][j]-matrix->rows[i][i])/(2*SYM_ENTRY(matrix, i, j));
+}
+
+double calcT(double theta){
+    /*calcs t as part os jacobi computations*/
+    int sign = theta < 0 ? -1 : 1;
+    double denom = fabs(theta)+sqrt(pow(theta,2)+1);
+    return sign/denom;
+}
+
+double calcC(double t){
+    /*calcs c as part os jacobi computations*/
+    return 1 / (sqrt(pow(t,2)+1));
+}
+
+double calcS(double t, double c){
+    /*calcs s as part os jacobi computations*/
+    return t*c;
+}
+
+void applyRotationToV(double **V, int i, int j, double c, double s){
+    /*V = V*P for the rotation matrix P of (i,j,c,s) while jacobi holds V
+    transposed, eigenvectors as rows: only rows i and j change, two
+    contiguous runs instead of two entries in every row. P is never built*/
+    rotateRuns(V[i], V[j], numOfVectors, c, s);
+}
+
+void rotateRuns(double *runI, double *runJ, int count, double c, double s){
+    /*the Givens rotation of two contiguous runs, runI = c*runI - s*runJ
+    and runJ = c*runJ + s*runI, two entries per SSE2 instruction. Same
+    operations in the same order as the scalar tail, so the same bits*/
+    int r = 0;
+    double ari, arj;
+#ifdef __SSE2__
+    __m128d vc = _mm_set1_pd(c), vs = _mm_set1_pd(s), vi, vj;
+    for (; r + 2 <= count; r += 2){
+        vi = _mm_loadu_pd(runI + r);
+        vj = _mm_loadu_pd(runJ + r);
+        _mm_storeu_pd(runI + r, _mm_sub_pd(_mm_mul_pd(vc, vi), _mm_mul_pd(vs, vj)));
+        _mm_storeu_pd(runJ + r, _mm_add_pd(_mm_mul_pd(vc, vj), _mm_mul_pd(vs, vi)));
+    }
+#endif
+    for (; r < count; r++){
+        ari = runI[r];
+        arj = runJ[r];
+        runI[r] = c*ari-s*arj;
+        runJ[r] = c*arj+s*ari;
+    }
+}
+
+void rotateSymMatrix(symMatrix *A, int i, int j, double c, double s){
+    /*A = P^T A P in place for the rotation (i,j,c,s) with i < j, by the
+    five equations in instructions. In the packed lower triangle rows i
+    and j are contiguous left of i; between i and j column i, and right
+    of j columns i and j are gathered ROTATE_BLOCK rows at a time, rotated
+    as runs and scattered back. The diagonal terms come first, from the
+    old entries*/
+    int r, from, count;
+    double aii = A->rows[i][i], ajj = A->rows[j][j], aij = A->rows[j][i];
+    double columnI[ROTATE_BLOCK], columnJ[ROTATE_BLOCK];
+
+    A->rows[i][i] = pow(c,2)*aii+pow(s,2)*ajj-2*s*c*aij;
+    A->rows[j][j] = pow(s,2)*aii+pow(c,2)*ajj+2*s*c*aij;
+    A->rows[j][i] = 0;
+    rotateRuns(A->rows[i], A->rows[j], i, c, s); /*r < i*/
+    for (from = i + 1; from < j; from += ROTATE_BLOCK){ /*i < r < j*/
+        count = j - from < ROTATE_BLOCK ? j - from : ROTATE_BLOCK;
+        for (r = 0; r < count; r++){
+            columnI[r] = A->rows[from + r][i];
+        }
+        rotateRuns(columnI, A->rows[j] + from, count, c, s);
+        for (r = 0; r < count; r++){
+            A->rows[from + r][i] = columnI[r];
+        }
+    }
+    for (from = j + 1; from < A->n; from += ROTATE_BLOCK){ /*r > j*/
+        count = A->n - from < ROTATE_BLOCK ? A->n - from : ROTATE_BLOCK;
+        for (r = 0; r < count; r++){
+            columnI[r] = A->rows[from + r][i];
+            columnJ[r] = A->rows[from + r][j];
+        }
+        rotateRuns(columnI, columnJ, count, c, s);
+        for (r = 0; r < count; r++){
+            A->rows[from + r][i] = columnI[r];
+            A->rows[from + r][j] = columnJ[r];
+        }
+    }
+}
+
+double calcOffSquared(symMatrix *mat){
+    /*gets a matrix and calculates the sum of off-diagonal elements squared,
+    the lower triangle is summed once and doubled*/
+    int i,j;
+    double sum = 0;
+    for (i = 1; i < mat->n; i++){
+        for (j = 0; j < i; j++){
+            sum += pow(mat->rows[i][j],2);
+        }
+    }
+    return 2*sum;
+}
+
+int checkConvergence(double a, double ap){
+    /*gets the off values of A and A' and checks if they are closer than epsilon*/
+    double epsilon = pow(10,-15); /*constant from instructions*/
+    
+    if ((a-ap)<=epsilon){
+        return 1;
+    }
+    return 0;
+}
+
+void printJacobi(symMatrix *A, double **V) {
+    /*gets A matrix (for eigenvalues) and V matrix (for eigenvectors) 
+    and prints them according to instructions*/
+    int i,j;
+    for (i = 0; i < numOfVectors; i++) {
+        if ((A->rows[i][i]<0)&&(A->rows[i][i]>-0.00005)){
+                A->rows[i][i] = 0;
+        }
+        printf("%.4f", A->rows[i][i]); /*eigenvalues, Format to 4 digits*/
+            if (i < numOfVectors - 1) {
+                printf(",");
+            }
+    }
+    printf("\n");
+    for (i = 0; i < numOfVectors; i++) {
+        for (j = 0; j < numOfVectors; j++) {
+            if ((V[j][i]<0)&&(V[j][i]>-0.00005)){
+                V[j][i] = 0;
+            }
+            printf("%.4f", V[j][i]); /*Transpose V, Format to 4 digits*/
+            if (j < numOfVectors - 1) {
+                printf(",");
+            }
+        }
+        if ( i < numOfVectors - 1) {
+            printf("\n");
+        }
+    }
+}
+
+int loadWarmBasis(char *path, double **basis, int n) {
+    /*reads an n x n eigenvector basis saved by saveWarmBasis, returns 0
+    when the file is missing or holds a basis of another size*/
+    unsigned int header[WARM_HEADER];
+    int i, isLoaded;
+    FILE *file = fopen(path, "rb");
+
+    if (file == NULL) {
+        return 0;
+    }
+    isLoaded = fread(header, sizeof(unsigned int), WARM_HEADER, file) == WARM_HEADER
+        && header[0] == WARM_MAGIC && header[1] == WARM_VERSION && header[2] == (unsigned int)n;
+    for (i = 0; isLoaded && i < n; i++) {
+        isLoaded = fread(basis[i], sizeof(double), n, file) == (size_t)n;
+    }
+    fclose(file);
+    return isLoaded;
+}
+
+void saveWarmBasis(char *path, double **basis, int n) {
+    /*writes the eigenvectors of this run for the next one to start from,
+    failures are ignored since the file is only an optimization*/
+    unsigned int header[WARM_HEADER];
+    char tmpPath[EIGEN_CACHE_PATH_LEN];
+    int i;
+    FILE *file;
+
+    errorAssert(strlen(path) + 4 < EIGEN_CACHE_PATH_LEN,1);
+    sprintf(tmpPath, "%s.tmp", path);
+    file = fopen(tmpPath, "wb");
+    if (file == NULL) {
+        return;
+    }
+    header[0] = WARM_MAGIC;
+    header[1] = WARM_VERSION;
+    header[2] = (unsigned int)n;
+    header[3] = 0; /*reserved, keeps the data 8-byte aligned*/
+    fwrite(header, sizeof(unsigned int), WARM_HEADER, file);
+    for (i = 0; i < n; i++) {
+        fwrite(basis[i], sizeof(double), n, file);
+    }
+    if (fclose(file) == 0) {
+        rename(tmpPath, path); /*readers never see a partial file*/
+    }
+    else {
+        remove(tmpPath);
+    }
+}
+
+void* checkpointWriter(void *arg) {
+    /*writes every committed snapshot to its file (tmp + rename), so the
+    compute loop never waits on the disk*/
+    (void)arg;
+#ifdef SPK_THREADS
+    pthread_mutex_lock(&checkpointLock);
+    while (1) {
+        while (!snapshot.pending && !snapshot.stop) {
+            pthread_cond_wait(&checkpointReady, &checkpointLock);
+        }
+        if (!snapshot.pending) {
+            break;
+        }
+        pthread_mutex_unlock(&checkpointLock);
+        writeSnapshot();
+        pthread_mutex_lock(&checkpointLock);
+        snapshot.pending = 0;
+        pthread_cond_broadcast(&checkpointIdle);
+    }
+    pthread_mutex_unlock(&checkpointLock);
+#endif
+    return NULL;
+}
+
+void writeSnapshot() {
+    /*failures are ignored, the last complete checkpoint stays in place*/
+    char tmpPath[EIGEN_CACHE_PATH_LEN + 4];
+    FILE *file;
+
+    sprintf(tmpPath, "%s.tmp", snapshot.path);
+    file = fopen(tmpPath, "wb");
+    if (file == NULL) {
+        return;
+    }
+    fwrite(snapshot.data, 1, snapshot.size, file);
+    if (fclose(file) == 0) {
+        rename(tmpPath, snapshot.path);
+    }
+    else {
+        remove(tmpPath);
+    }
+}
+
+void startCheckpoints() {
+    snapshot.data = NULL;
+    snapshot.size = snapshot.capacity = 0;
+    snapshot.pending = snapshot.stop = 0;
+#ifdef SPK_THREADS
+    pthread_mutex_init(&checkpointLock, NULL);
+    pthread_cond_init(&checkpointReady, NULL);
+    pthread_cond_init(&checkpointIdle, NULL);
+    errorAssert(pthread_create(&checkpointThread, NULL, checkpointWriter, NULL) == 0,0);
+#endif
+}
+
+void stopCheckpoints() {
+    /*waits for the last snapshot to reach the disk*/
+#ifdef SPK_THREADS
+    pthread_mutex_lock(&checkpointLock);
+    snapshot.stop = 1;
+    pthread_cond_signal(&checkpointReady);
+    pthread_mutex_unlock(&checkpointLock);
+    pthread_join(checkpointThread, NULL);
+    pthread_cond_destroy(&checkpointIdle);
+    pthread_cond_destroy(&checkpointReady);
+    pthread_mutex_destroy(&checkpointLock);
+#endif
+    free(snapshot.data);
+    snapshot.data = NULL;
+}
+
+char* checkpointBuffer(char *suffix, size_t size, int wait) {
+    /*returns the snapshot buffer for a checkpoint of size bytes, or NULL
+    when the previous one is still being written and wait is 0, so a slow
+    disk costs a skipped checkpoint instead of a stalled loop*/
+    char *data;
+#ifdef SPK_THREADS
+    pthread_mutex_lock(&checkpointLock);
+    while (wait && snapshot.pending) {
+        pthread_cond_wait(&checkpointIdle, &checkpointLock);
+    }
+    if (snapshot.pending) {
+        pthread_mutex_unlock(&checkpointLock);
+        return NULL;
+    }
+    pthread_mutex_unlock(&checkpointLock);
+#else
+    (void)wait;
+#endif
+    errorAssert(strlen(checkpointPath) + 16 < EIGEN_CACHE_PATH_LEN,1);
+    sprintf(snapshot.path, "%s%s", checkpointPath, suffix);
+    if (size > snapshot.capacity) {
+        data = (char *)realloc(snapshot.data, size);
+        errorAssert(data != NULL,0);
+        snapshot.data = data;
+        snapshot.capacity = size;
+    }
+    snapshot.size = size;
+    return snapshot.data;
+}
+
+void commitCheckpoint() {
+    /*hands the filled snapshot buffer to the writer*/
+#ifdef SPK_THREADS
+    pthread_mutex_lock(&checkpointLock);
+    snapshot.pending = 1;
+    pthread_cond_signal(&checkpointReady);
+    pthread_mutex_unlock(&checkpointLock);
+#else
+    writeSnapshot();
+#endif
+}
+
+int checkpointDue(double *last) {
+    /*1 every checkpointSeconds, the first time after one interval*/
+    double now;
+    if (checkpointPath == NULL) {
+        return 0;
+    }
+    now = profileNow();
+    if (*last < 0) {
+        *last = now;
+    }
+    return now - *last >= checkpointSeconds*1e6;
+}
+
+int saveCheckpoint(char *suffix, unsigned int *header, double **rows,
+                   int numOfRows, size_t *rowSizes, int wait) {
+    /*copies the header and the rows into a snapshot for the writer,
+    returns 0 when it was skipped*/
+    int i;
+    size_t size = CHECKPOINT_HEADER*sizeof(unsigned int);
+    char *data;
+
+    for (i = 0; i < numOfRows; i++) {
+        size += rowSizes[i]*sizeof(double);
+    }
+    data = checkpointBuffer(suffix, size, wait);
+    if (data == NULL) {
+        return 0;
+    }
+    memcpy(data, header, CHECKPOINT_HEADER*sizeof(unsigned int));
+    data += CHECKPOINT_HEADER*sizeof(unsigned int);
+    for (i = 0; i < numOfRows; i++) {
+        memcpy(data, rows[i], rowSizes[i]*sizeof(double));
+        data += rowSizes[i]*sizeof(double);
+    }
+    commitCheckpoint();
+    return 1;
+}
+
+int loadCheckpoint(char *suffix, unsigned int *header, double **rows,
+                   int numOfRows, size_t *rowSizes) {
+    /*reads a checkpoint into rows when its first seven header words (the
+    key) match header, then fills in the rest of the header. Returns 1
+    on success, rows may be partly overwritten otherwise*/
+    char path[EIGEN_CACHE_PATH_LEN];
+    unsigned int saved[CHECKPOINT_HEADER];
+    int i, isLoaded;
+    FILE *file;
+
+    errorAssert(strlen(checkpointPath) + 16 < EIGEN_CACHE_PATH_LEN,1);
+    sprintf(path, "%s%s", checkpointPath, suffix);
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    isLoaded = fread(saved, sizeof(unsigned int), CHECKPOINT_HEADER, file) == CHECKPOINT_HEADER;
+    for (i = 0; isLoaded && i < 7; i++) {
+        isLoaded = saved[i] == header[i];
+    }
+    for (i = 0; isLoaded && i < numOfRows; i++) {
+        isLoaded = fread(rows[i], sizeof(double), rowSizes[i], file) == rowSizes[i];
+    }
+    fclose(file);
+    if (isLoaded) {
+        memcpy(header, saved, CHECKPOINT_HEADER*sizeof(unsigned int));
+    }
+    return isLoaded;
+}
+
+void rotateIntoBasis(symMatrix *A, double **basis) {
+    /*A = basis^T A basis. With the eigenvectors of a slightly different
+    matrix only a small off-diagonal residual is left for the rotations.
+    Both products run along rows, O(n^3) each*/
+    int r, c, i, j, n = A->n;
+    double a, v, *row, **product = allocDenseMatrix(n, n);
+
+    for (r = 0; r < n; r++) { /*product = A basis*/
+        for (c = 0; c < n; c++) {
+            a = SYM_ENTRY(A, r, c);
+            row = basis[c];
+            for (j = 0; j < n; j++) {
+                product[r][j] += a*row[j];
+            }
+        }
+    }
+    memset(A->data, 0, (size_t)n*(n+1)/2*sizeof(double));
+    for (r = 0; r < n; r++) { /*lower triangle of basis^T product*/
+        row = product[r];
+        for (i = 0; i < n; i++) {
+            v = basis[r][i];
+            for (j = 0; j <= i; j++) {
+                A->rows[i][j] += v*row[j];
+            }
+        }
+    }
+    freeDenseMatrix(product);
+}
+
+void jacobiCheckpointHeader(symMatrix *A, unsigned int *header) {
+    /*key of a jacobi checkpoint: the size, cap and a hash of the input*/
+    unsigned int hash[2], params[2];
+
+    params[0] = (unsigned int)A->n;
+    params[1] = (unsigned int)maxRotations;
+    hash[0] = 2166136261u;
+    hash[1] = 5381u;
+    hashBytes(hash, params, sizeof(params));
+    hashBytes(hash, A->data, (size_t)A->n*(A->n+1)/2*sizeof(double));
+    header[0] = CHECKPOINT_MAGIC;
+    header[1] = CHECKPOINT_VERSION;
+    header[2] = CHECKPOINT_JACOBI;
+    header[3] = params[0];
+    header[4] = params[1];
+    header[5] = hash[0];
+    header[6] = hash[1];
+    header[7] = header[8] = header[9] = 0; /*rotations, done, reserved*/
+}
+
+int saveJacobiCheckpoint(symMatrix *A, unsigned int *header, int count, int isDone, int wait) {
+    /*snapshot of A (packed), V as jacobi holds it (eigenvectors as rows)
+    and the rotation count*/
+    int i, n = A->n;
+    double **rows;
+    size_t *sizes;
+
+    rows = (double **)calloc(n + 1, sizeof(double *));
+    sizes = (size_t *)calloc(n + 1, sizeof(size_t));
+    errorAssert(rows != NULL && sizes != NULL,0);
+    rows[0] = A->data;
+    sizes[0] = (size_t)n*(n+1)/2;
+    for (i = 0; i < n; i++) {
+        rows[i+1] = V[i];
+        sizes[i+1] = n;
+    }
+    header[7] = (unsigned int)count;
+    header[8] = (unsigned int)isDone;
+    i = saveCheckpoint(".jacobi", header, rows, n + 1, sizes, wait);
+    free(rows);
+    free(sizes);
+    return i;
+}
+
+int loadJacobiCheckpoint(symMatrix *A, unsigned int *header) {
+    /*restores A, V and the rotation count, A keeps its input on a miss*/
+    int i, n = A->n, isLoaded;
+    double **rows, *data;
+    size_t *sizes;
+
+    data = (double *)calloc((size_t)n*(n+1)/2 + 1, sizeof(double));
+    rows = (double **)calloc(n + 1, sizeof(double *));
+    sizes = (size_t *)calloc(n + 1, sizeof(size_t));
+    errorAssert(data != NULL && rows != NULL && sizes != NULL,0);
+    rows[0] = data;
+    sizes[0] = (size_t)n*(n+1)/2;
+    for (i = 0; i < n; i++) {
+        rows[i+1] = V[i];
+        sizes[i+1] = n;
+    }
+    isLoaded = loadCheckpoint(".jacobi", header, rows, n + 1, sizes);
+    if (isLoaded) {
+        memcpy(A->data, data, sizes[0]*sizeof(double));
+    }
+    else {
+        for (i = 0; i < n; i++) { /*V may hold part of the file*/
+            memset(V[i], 0, n*sizeof(double));
+        }
+        header[7] = header[8] = 0;
+    }
+    free(data);
+    free(rows);
+    free(sizes);
+    return isLoaded;
+}
+
+symMatrix* jacobi(symMatrix *A, int toPrint){
+    /*calculates jacobi iterations until convergence*/
+    int i, maxRow, maxCol, count=0, isConverged=0, isWarm = 0, isResumed = 0;
+    int* maxValInd;
+    double theta, t, c, s, start = PROFILE_NOW(), startOff, lastCheckpoint = -1;
+    double off, offPrime;
+    unsigned int header[CHECKPOINT_HEADER];
+
+    V = allocDenseMatrix(numOfVectors, numOfVectors);
+    if (checkpointPath != NULL) { /*keyed by the input matrix*/
+        jacobiCheckpointHeader(A, header);
+        isResumed = resumeRun && loadJacobiCheckpoint(A, header);
+        count = (int)header[7];
+        isConverged = (int)header[8];
+    }
+    if (!isResumed) {
+        isWarm = warmPath != NULL && loadWarmBasis(warmPath, V, numOfVectors);
+    }
+    if (isWarm) { /*continue from an earlier run's eigenvectors*/
+        rotateIntoBasis(A, V);
+        squareMatrixTranspose(V, numOfVectors); /*eigenvectors as rows, see applyRotationToV*/
+        PROFILE_STAGE("jacobi_warm", start, numOfVectors);
+    }
+    else if (!isResumed) {
+        for (i = 0; i < numOfVectors; i++) {
+            V[i][i] = 1; /*init V as I matrix for neutrality to multiplication*/
+        }
+    }
+    off = calcOffSquared(A);
+    startOff = sqrt(off);
+
+    while ((isConverged==0)&&(count<maxRotations)) { /*until convergence or 100 iterations*/
+
+        maxValInd = maxOffDiagonalValue(A);      
+        if (maxValInd == NULL) { /*a 1 x 1 matrix is already diagonal*/
+            break;
+        }
+        maxRow = maxValInd[0];
+        maxCol = maxValInd[1];
+        free(maxValInd);
+
+        if (A->rows[maxCol][maxRow] == 0) { /*matrix is already diagonal*/
+            break;
+        }
+        theta = calcTheta(A, maxRow, maxCol);
+        t = calcT(theta);
+        c = calcC(t);
+        s = calcS(t, c);
+
+        applyRotationToV(V, maxRow, maxCol, c, s); /*updating eigenvectors matrix*/
+
+        rotateSymMatrix(A, maxRow, maxCol, c, s); /*A becomes A'*/
+        offPrime = calcOffSquared(A);
+        isConverged = checkConvergence(off, offPrime); /*checks convergence*/
+        off = offPrime; /*the next rotation starts from A'*/
+        count++; /*iterations count*/
+        if (checkpointDue(&lastCheckpoint) && saveJacobiCheckpoint(A, header, count, isConverged, 0)) {
+            lastCheckpoint = profileNow();
+        }
+    }
+
+    if (checkpointPath != NULL) { /*the final state lets a resume skip jacobi*/
+        saveJacobiCheckpoint(A, header, count, 1, 1);
+    }
+    squareMatrixTranspose(V, numOfVectors); /*back to eigenvectors as columns*/
+    if (warmPath != NULL) {
+        saveWarmBasis(warmPath, V, numOfVectors);
+    }
+    if (profiling) {
+        profileStage("jacobi", start, numOfVectors);
+        profileCount("jacobi_warm", isWarm);
+        profileCount("jacobi_resumed", isResumed);
+        profileCount("jacobi_start_off_norm", startOff);
+        profileCount("jacobi_rotations", count);
+        profileCount("jacobi_off_norm", sqrt(off));
+        profileCount("jacobi_cap_hit", isConverged==0 && count>=maxRotations);
+    }
+
+    if (toPrint==0) { /*if further calculations are necessary*/
+        return A;
+    }
+    else { /*if goal was jacobi, only need to be printed*/
+        printJacobi(A, V);
+        /*free2DDoubleArray(A, numOfVectors);*/
+        return NULL;
+    }
+}  
+
+int compareEigenVectors(const void *a, const void *b) {
+    /*comperator of vectors for quicksort*/
+    struct eigenVector *eva = (struct eigenVector *) a;
+    struct eigenVector *evb = (struct eigenVector *) b;
+    double diff = eva->eigenVal - evb->eigenVal; /*by eigen values*/
+    if (diff==0){
+        return eva->columnIndex - evb->columnIndex; /*then, by index*/
+    }
+    else{
+        return diff > 0 ? 1 : -1; 
+    }    
+}
+
+void sortEigenVectorsAndValues() {
+    /*sorts eigen vecctors using quicksort 
+    and sorts eigen values accordingly*/
+    int i;
+    eigenVectors = (eigenVector *)calloc(numOfEigenVals, sizeof(eigenVector));
+    errorAssert(eigenVectors != NULL,0);
+    for (i = 0; i < numOfEigenVals; i++) { /*sets eigenvector's attributes*/
+        eigenVectors[i].columnIndex = i;
+        eigenVectors[i].eigenVal = eigenVals[i];
+    }
+    
+    /*sorting*/
+    qsort(eigenVectors, numOfEigenVals, sizeof(eigenVector), compareEigenVectors);
+    for (i = 0; i < numOfEigenVals; i++) {
+        eigenVals[i] = eigenVectors[i].eigenVal;
+    }
+}
+
+void hashBytes(unsigned int hash[2], void *data, size_t size) {
+    /*feeds bytes to the FNV-1a and djb2 hashes side by side*/
+    size_t b;
+    unsigned char *bytes = (unsigned char *)data;
+    for (b = 0; b < size; b++) {
+        hash[0] = (hash[0] ^ bytes[b]) * 16777619u;
+        hash[1] = hash[1] * 33u + bytes[b];
+    }
+}
+
+void hashRows(unsigned int hash[2], unsigned int *params, size_t numOfParams, int numOfRows) {
+    /*hashes params and then the first numOfRows input vectors*/
+    int i;
+    hash[0] = 2166136261u;
+    hash[1] = 5381u;
+    hashBytes(hash, params, numOfParams*sizeof(unsigned int));
+    for (i = 0; i < numOfRows; i++) {
+        hashBytes(hash, vectors[i], dimension*sizeof(double));
+    }
+}
+
+void hashVectors(unsigned int hash[2]) {
+    /*hashes the input vectors and the parameters of the spectral stage
+    to key the eigen cache*/
+    unsigned int params[6];
+
+    params[0] = EIGEN_CACHE_VERSION; /*bumped whenever the solver changes*/
+    params[1] = (unsigned int)maxRotations; /*the cap of the exact path*/
+    params[2] = (unsigned int)numOfVectors;
+    params[3] = (unsigned int)dimension;
+    params[4] = (unsigned int)numOfLandmarks; /*0 for the exact path*/
+    params[5] = eigenCacheReal();
+    hashRows(hash, params, 6, numOfVectors);
+}
+
+unsigned int eigenCacheReal() {
+    /*sizeof(spkReal) when the eigenpairs depend on it (the Nystrom
+    affinities), so SPK_FLOAT32 and double builds never share a Nystrom
+    file, and 0 on the exact path, which is all double*/
+    return numOfLandmarks > 0 ? (unsigned int)sizeof(spkReal) : 0;
+}
+
+void eigenCachePath(char *path, unsigned int hash[2]) {
+    /*builds the cache file name for the given key inside cacheDir*/
+    errorAssert(strlen(cacheDir) < EIGEN_CACHE_PATH_LEN - 32,1);
+    sprintf(path, "%s/spk_%08x%08x.eig", cacheDir, hash[0], hash[1]);
+}
+
+int loadEigenCache() {
+    /*maps a cached sorted eigendecomposition of the current vectors and
+    points V, eigenVals and eigenVectors at it, returns 1 on a cache hit.
+    file layout: header, m sorted eigenvalues, then V (n x m, row major)
+    with its columns already in sorted order (m is n on the exact path).
+    A Nystrom file goes on with the landmark D^-0.5 (m), 1/A_cc (m) and
+    the landmark basis (m x m), in the same column order*/
+    int i, m;
+    unsigned int hash[2], header[EIGEN_CACHE_HEADER];
+    char path[EIGEN_CACHE_PATH_LEN];
+    size_t size;
+    FILE *file;
+    double *data;
+
+    hashVectors(hash);
+    eigenCachePath(path, hash);
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    i = fread(header, sizeof(unsigned int), EIGEN_CACHE_HEADER, file) == EIGEN_CACHE_HEADER;
+    fclose(file);
+    if (!i || header[0] != EIGEN_CACHE_MAGIC || header[1] != EIGEN_CACHE_VERSION
+        || header[2] != (unsigned int)numOfVectors || header[3] != (unsigned int)dimension
+        || header[5] != eigenCacheReal() || header[6] != hash[0] || header[7] != hash[1]) {
+        return 0;
+    }
+
+    numOfEigenVals = (int)header[4];
+    m = numOfLandmarks > 0 ? numOfEigenVals : 0;
+    size = sizeof(header) + ((size_t)numOfEigenVals*(numOfVectors+1) + (size_t)m*(m+2))*sizeof(double);
+    eigenCache = mapFile(path, size);
+    if (eigenCache == NULL) {
+        return 0;
+    }
+    eigenCacheSize = size;
+    data = eigenCache + sizeof(header)/sizeof(double);
+
+    eigenVals = (double *)calloc(numOfEigenVals, sizeof(double));
+    errorAssert(eigenVals != NULL,0);
+    eigenVectors = (eigenVector *)calloc(numOfEigenVals, sizeof(eigenVector));
+    errorAssert(eigenVectors != NULL,0);
+    for (i = 0; i < numOfEigenVals; i++) {
+        eigenVals[i] = data[i];
+        eigenVectors[i].eigenVal = data[i];
+        eigenVectors[i].columnIndex = i; /*columns are stored sorted*/
+    }
+    V = (double **)calloc(numOfVectors, sizeof(double *));
+    errorAssert(V != NULL,0);
+    for (i = 0; i < numOfVectors; i++) {
+        V[i] = data + numOfEigenVals + (size_t)i*numOfEigenVals;
+    }
+    if (m > 0) { /*small, copied so the model outlives the mapping*/
+        data += (size_t)numOfEigenVals*(numOfVectors+1);
+        allocLandmarkModel(m);
+        memcpy(landmarkDinv, data, m*sizeof(double));
+        memcpy(landmarkInvA, data + m, m*sizeof(double));
+        memcpy(landmarkBasis, data + 2*m, (size_t)m*m*sizeof(double));
+    }
+    return 1;
+}
+
+void saveEigenCache() {
+    /*writes the sorted eigendecomposition to the cache, failures are ignored
+    since the cache is only an optimization*/
+    int i, j;
+    unsigned int hash[2], header[EIGEN_CACHE_HEADER];
+    char path[EIGEN_CACHE_PATH_LEN], tmpPath[EIGEN_CACHE_PATH_LEN + 4];
+    double *row;
+    FILE *file;
+
+    hashVectors(hash);
+    eigenCachePath(path, hash);
+    sprintf(tmpPath, "%s.tmp", path);
+    file = fopen(tmpPath, "wb");
+    if (file == NULL) {
+        return;
+    }
+    header[0] = EIGEN_CACHE_MAGIC;
+    header[1] = EIGEN_CACHE_VERSION;
+    header[2] = (unsigned int)numOfVectors;
+    header[3] = (unsigned int)dimension;
+    header[4] = (unsigned int)numOfEigenVals;
+    header[5] = eigenCacheReal();
+    header[6] = hash[0];
+    header[7] = hash[1];
+
+    row = (double *)calloc(numOfEigenVals, sizeof(double));
+    errorAssert(row != NULL,0);
+    fwrite(header, sizeof(unsigned int), EIGEN_CACHE_HEADER, file);
+    fwrite(eigenVals, sizeof(double), numOfEigenVals, file);
+    for (i = 0; i < numOfVectors; i++) {
+        for (j = 0; j < numOfEigenVals; j++) {
+            row[j] = V[i][eigenVectors[j].columnIndex]; /*sorted column order*/
+        }
+        fwrite(row, sizeof(double), numOfEigenVals, file);
+    }
+    if (landmarkBasis != NULL) {
+        for (j = 0; j < numOfEigenVals; j++) {
+            row[j] = landmarkDinv[j]; /*per landmark, not per column*/
+        }
+        fwrite(row, sizeof(double), numOfEigenVals, file);
+        for (j = 0; j < numOfEigenVals; j++) {
+            row[j] = landmarkInvA[eigenVectors[j].columnIndex];
+        }
+        fwrite(row, sizeof(double), numOfEigenVals, file);
+        for (i = 0; i < numOfEigenVals; i++) {
+            for (j = 0; j < numOfEigenVals; j++) {
+                row[j] = landmarkBasis[(size_t)i*numOfEigenVals + eigenVectors[j].columnIndex];
+            }
+            fwrite(row, sizeof(double), numOfEigenVals, file);
+        }
+    }
+    free(row);
+    if (fclose(file) == 0) {
+        rename(tmpPath, path); /*readers never see a partial file*/
+    }
+    else {
+        remove(tmpPath);
+    }
+}
+
+double* mapFile(char *path, size_t size) {
+    /*maps a whole file read-only, returns NULL on failure*/
+    double *map;
+#ifndef _WIN32
+    int fd;
+    struct stat st;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != size) {
+        close(fd);
+        return NULL;
+    }
+    map = (double *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    return map == MAP_FAILED ? NULL : map;
+#else
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    map = (double *)malloc(size);
+    if (map != NULL && fread(map, 1, size, file) != size) {
+        free(map);
+        map = NULL;
+    }
+    fclose(file);
+    return map;
+#endif
+}
+
+void unmapFile(double *map, size_t size) {
+    /*releases a mapping made by mapFile*/
+#ifndef _WIN32
+    munmap(map, size);
+#else
+    (void)size;
+    free(map);
+#endif
+}
+
+void nystromEigenpairs() {
+    /*approximates the eigenpairs of lnorm from numOfLandmarks evenly spaced
+    landmark points (Nystrom method): only the n x m affinities to the
+    landmarks are built, the m x m normalized landmark block is diagonalized
+    and its eigenvectors are extended to all points. fills V (n x m) and
+    eigenVals (m) so createUMatrix and kmeans run as usual*/
+    int i, l, c, m = numOfLandmarks, savedNumOfVectors = numOfVectors;
+    int savedMaxRotations = maxRotations, *landmarks;
+    double **landmarkV, *dinv, sum, w;
+    spkReal *C; /*n x m affinities, row major*/
+    symMatrix A;
+
+    errorAssert(m > 1 && m <= numOfVectors,1);
+    allocLandmarkModel(m); /*kept for out-of-sample points, see buildModel*/
+    landmarks = landmarkRows;
+
+    /*affinities to the landmarks and a sampling estimate of the degrees*/
+    C = (spkReal *)allocLarge((size_t)numOfVectors*m, sizeof(spkReal));
+    dinv = (double *)calloc(numOfVectors, sizeof(double));
+    errorAssert(dinv != NULL,0);
+    for (i = 0; i < numOfVectors; i++) {
+        sum = 0;
+        for (l = 0; l < m; l++) {
+            w = 0;
+            if (i != landmarks[l]) { /*no self loops, as in wam*/
+                w = calcWeightsForAdjacencyMatrix(vectors[i], vectors[landmarks[l]]);
+            }
+            C[(size_t)i*m+l] = (spkReal)w;
+            sum += w; /*degrees are summed before any rounding to spkReal*/
+        }
+        dinv[i] = 1/sqrt(sum * numOfVectors / m);
+    }
+    for (i = 0; i < numOfVectors; i++) {
+        for (l = 0; l < m; l++) {
+            C[(size_t)i*m+l] = (spkReal)((dinv[i]*C[(size_t)i*m+l])*dinv[landmarks[l]]); /*D^-0.5 W D^-0.5*/
+        }
+    }
+
+    /*diagonalizes the landmark block, jacobi works on numOfVectors rows*/
+    allocSymMatrix(&A, m);
+    for (l = 0; l < m; l++) {
+        for (c = 0; c <= l; c++) {
+            A.rows[l][c] = C[(size_t)landmarks[l]*m+c];
+        }
+    }
+    numOfVectors = m;
+    maxRotations = NYSTROM_ROTATIONS_PER_ENTRY*m*m;
+    jacobi(&A, 0);
+    landmarkV = V;
+    numOfVectors = savedNumOfVectors;
+    maxRotations = savedMaxRotations;
+
+    /*extends the landmark eigenvectors to all points*/
+    numOfEigenVals = m;
+    eigenVals = (double *)calloc(m, sizeof(double));
+    errorAssert(eigenVals != NULL,0);
+    V = allocDenseMatrix(numOfVectors, m);
+    for (c = 0; c < m; c++) {
+        /*lnorm = I - D^-0.5 W D^-0.5, and the m x m block sees m of the n
+        points, so its eigenvalues are about m/n of the full matrix's.
+        Rescaled, the gaps compare with an exact run, the order is kept*/
+        eigenVals[c] = 1 - A.rows[c][c] * savedNumOfVectors / m;
+        if (fabs(A.rows[c][c]) < NYSTROM_MIN_EIGENVAL) {
+            continue; /*cannot be extended, left as a zero column*/
+        }
+        for (i = 0; i < numOfVectors; i++) {
+            sum = 0;
+            for (l = 0; l < m; l++) {
+                sum += C[(size_t)i*m+l]*landmarkV[l][c];
+            }
+            V[i][c] = sum / A.rows[c][c];
+        }
+    }
+
+    for (l = 0; l < m; l++) { /*what embedPoint needs to extend a new point the same way*/
+        landmarkDinv[l] = dinv[landmarks[l]];
+        landmarkInvA[l] = fabs(A.rows[l][l]) < NYSTROM_MIN_EIGENVAL ? 0 : 1 / A.rows[l][l];
+        memcpy(landmarkBasis + (size_t)l*m, landmarkV[l], m*sizeof(double));
+    }
+
+    freeLarge(C);
+    freeSymMatrix(&A);
+    freeDenseMatrix(landmarkV);
+    free(dinv);
+}
+
+int* chooseLandmarks(int m) {
+    /*m evenly spaced rows of the input, the same for the same n and m*/
+    int l, *landmarks = (int *)calloc(m, sizeof(int));
+    errorAssert(landmarks != NULL,0);
+    for (l = 0; l < m; l++) {
+        landmarks[l] = (int)((double)l * numOfVectors / m);
+    }
+    return landmarks;
+}
+
+void allocLandmarkModel(int m) {
+    /*allocates the landmark globals kept after nystromEigenpairs*/
+    landmarkRows = chooseLandmarks(m);
+    landmarkDinv = (double *)calloc(m, sizeof(double));
+    errorAssert(landmarkDinv != NULL,0);
+    landmarkInvA = (double *)calloc(m, sizeof(double));
+    errorAssert(landmarkInvA != NULL,0);
+    landmarkBasis = (double *)calloc((size_t)m*m, sizeof(double));
+    errorAssert(landmarkBasis != NULL,0);
+}
+
+int eigengapHeuristic(){
+    /*calculates eigengaps for eigengap heuristic and calculates k*/
+    int i, limit, k=0, isCached;
+    double maxGap = -1.0, start = PROFILE_NOW(), stageStart;
+    symMatrix *A;
+    
+    isCached = (cacheDir != NULL) && (loadEigenCache() == 1);
+    if (cacheDir != NULL) {
+        PROFILE_STAGE("cache_load", start, isCached);
+    }
+    if (!isCached) {
+        if (numOfLandmarks > 0) {
+            stageStart = PROFILE_NOW();
+            nystromEigenpairs(); /*approximation for very large inputs*/
+            PROFILE_STAGE("nystrom", stageStart, numOfLandmarks);
+        }
+        else {
+            A = jacobi(laplacianNorm(), 0); /*not for printing*/
+
+            numOfEigenVals = numOfVectors;
+            eigenVals = (double *)calloc(numOfVectors, sizeof(double));
+            for (i = 0; i < numOfVectors; i++) {
+                eigenVals[i] = A->rows[i][i]; /*eigenvals are on the diagonal line*/
+            }
+            freeSymMatrix(A);
+        }
+        stageStart = PROFILE_NOW();
+        sortEigenVectorsAndValues(); /*sorting eigenvectors and eigenvals*/
+        PROFILE_STAGE("sort", stageStart, 0);
+        if (cacheDir != NULL) {
+            stageStart = PROFILE_NOW();
+            saveEigenCache();
+            PROFILE_STAGE("cache_save", stageStart, 0);
+        }
+    }
+    eigenGaps = (double *)calloc(numOfEigenVals - 1, sizeof(double));
+    for (i = 0; i < numOfEigenVals - 1; i++) {
+        /*calculates eigen gaps*/
+        eigenGaps[i] = fabs(eigenVals[i]-eigenVals[i+1]);
+    }
+    limit = (int) floor(numOfEigenVals / 2);
+    for (i = 0; i < limit; i++) { /*finds k*/
+        if (eigenGaps[i] > maxGap) {
+            maxGap = eigenGaps[i];
+            k = i;
+        }
+    }
+    PROFILE_STAGE("eigengap", start, k + 1);
+    return k + 1; /*becuase count in intructions starts from 1*/
+}
+
+void normalizeUMatrix(double **mat, int numOfCols) {
+    /*normalizes U matrix to T matrix according to formula*/
+    int i,j;
+    double sum;
+    for (i = 0; i < numOfVectors; i++){
+        sum = 0;
+        for (j = 0; j < numOfCols; j++){
+            sum += pow(mat[i][j],2);
+        }
+        sum = sqrt(sum);
+        if (sum != 0){
+            for (j = 0; j < numOfCols; j++){
+                mat[i][j] = mat[i][j] / sum;
+            }
+        }
+    }
+}
+
+double** buildTMatrix(int numOfCols) {
+    /*takes numOfCols-smallest-eigenvals vectors from V matrix and normalizes
+    the rows, V is only read so several T matrices can be built at once*/
+    int i,j;
+    double **T;
+
+    errorAssert(numOfCols <= numOfEigenVals,1);
+    T = (double **)calloc(numOfVectors, sizeof(double *));
+    errorAssert(T != NULL,0);
+    for (i = 0; i < numOfVectors; i++) {
+        T[i] = (double *)calloc(numOfCols, sizeof(double));
+        errorAssert(T[i] != NULL,0);
+        for (j = 0; j < numOfCols; j++){
+            /*takes relevant column of V (eigenvectors are V's columns)*/
+            T[i][j] = V[i][eigenVectors[j].columnIndex]; 
+        }
+    }
+    normalizeUMatrix(T, numOfCols);
+    return T;
+}
+
+void createUMatrix() {
+    /*takes k-smallest-eigenvals vectors from V matrix*/
+    U = buildTMatrix(k);
 }
 
-double** jacobi(double **A, int toPrint){
-    /*calculates jacobi iterations until convergence*/
-    int i, maxRow, maxCol, count=0, isConverged=0, flag=2;
-    int* maxValInd;
-    double theta, t, c, s;
-    double **APrime, **P, **V1, **V2;
-
-    APrime = (double **)calloc(numOfVectors, numOfVectors*sizeof(double));
-    errorAssert(APrime != NULL,0);
-    P = (double **)calloc(numOfVectors, numOfVectors*sizeof(double));
-    errorAssert(P != NULL,0);
-    V1 = (double **)calloc(numOfVectors, numOfVectors*sizeof(double));
-    errorAssert(V1 != NULL,0);
-    for (i = 0; i < numOfVectors; i++) {
-        APrime[i] = (double *)calloc(numOfVectors, sizeof(double));
-        errorAssert(APrime[i] != NULL,0);
-        P[i] = (double *)calloc(numOfVectors, sizeof(double));
-        errorAssert(P[i] != NULL,0);
-        V1[i] = (double *)calloc(numOfVectors, sizeof(double));
-        errorAssert(V1[i] != NULL,0);
+void buildModel(spkModel *model, double **points, int numOfPoints, int dim, int numOfCols) {
+    /*keeps what predictPoint needs from the spectral stage that just ran on
+    points: D^-0.5, the numOfCols sorted eigenvectors (before the row
+    normalization) and their eigenvalues. centroids are set after kmeans.
+    A representative's D^-0.5 is scaled by its weight, a new point has
+    w_j times the affinity of a single point to it. After nystromEigenpairs
+    the rows are the landmarks with their basis and 1/A_cc, so a new point
+    is extended exactly like the training points were*/
+    int i, c, col, numOfRows = numOfPoints;
+    double *basis;
+
+    errorAssert(numOfCols <= numOfEigenVals,1);
+    if (landmarkBasis != NULL) {
+        numOfRows = numOfEigenVals;
+    }
+    else if (ddg == NULL) { /*eigen cache hit, the degrees were never streamed*/
+        diagonalDegreeMatrix(0);
+    }
+    model->points = points;
+    model->numOfPoints = numOfPoints;
+    model->numOfRows = numOfRows;
+    model->dim = dim;
+    model->k = numOfCols;
+    model->centroids = NULL;
+    model->landmarks = NULL;
+    model->dinv = (double *)calloc(numOfRows, sizeof(double));
+    errorAssert(model->dinv != NULL,0);
+    model->U = (double *)calloc((size_t)numOfRows*numOfCols, sizeof(double));
+    errorAssert(model->U != NULL,0);
+    model->invMu = (double *)calloc(numOfCols, sizeof(double));
+    errorAssert(model->invMu != NULL,0);
+    if (landmarkBasis != NULL) {
+        model->landmarks = (int *)calloc(numOfRows, sizeof(int));
+        errorAssert(model->landmarks != NULL,0);
+        memcpy(model->landmarks, landmarkRows, numOfRows*sizeof(int));
+    }
+    for (i = 0; i < numOfRows; i++) {
+        if (landmarkBasis != NULL) {
+            model->dinv[i] = landmarkDinv[i];
+            basis = landmarkBasis + (size_t)i*numOfRows;
+        }
+        else {
+            model->dinv[i] = pointWeights != NULL ? ddg[i]*pointWeights[i] : ddg[i];
+            basis = V[i];
+        }
+        for (c = 0; c < numOfCols; c++) {
+            model->U[(size_t)i*numOfCols+c] = basis[eigenVectors[c].columnIndex];
+        }
+    }
+    for (c = 0; c < numOfCols; c++) {
+        col = eigenVectors[c].columnIndex;
+        if (landmarkBasis != NULL) {
+            model->invMu[c] = landmarkInvA[col];
+        }
+        /*eigenvalue of D^-0.5 W D^-0.5 is 1 - the lnorm eigenvalue*/
+        else if (fabs(1 - eigenVectors[c].eigenVal) >= NYSTROM_MIN_EIGENVAL) {
+            model->invMu[c] = 1 / (1 - eigenVectors[c].eigenVal);
+        }
     }
+}
 
-    for (i = 0; i < numOfVectors; i++) { 
-        V1[i][i] = 1; /*init V as I matrix for מeutrality to multiplication*/
+void embedPoint(spkModel *model, double *point, double *row) {
+    /*Nystrom extension of a new point, O(rows*(d+k)): its affinities to the
+    training points (or the landmarks) scaled by their degrees, projected
+    onto U, divided by the eigenvalues and row normalized as in
+    normalizeUMatrix. The point's own D^-0.5 scales the whole row, so the
+    normalization cancels it. The affinity is calcWeightsForAdjacencyMatrix
+    over model->dim, the global dimension is k by the time spk predicts*/
+    int j, c, numOfCols = model->k;
+    double w, sum, *u, *p;
+
+    for (c = 0; c < numOfCols; c++) {
+        row[c] = 0;
+    }
+    for (j = 0; j < model->numOfRows; j++) {
+        p = model->points[model->landmarks != NULL ? model->landmarks[j] : j];
+        w = exp(-0.5*sqrt(vectorDistance(point, p, model->dim))) * model->dinv[j];
+        u = model->U + (size_t)j*numOfCols;
+        for (c = 0; c < numOfCols; c++) {
+            row[c] += w*u[c];
+        }
+    }
+    sum = 0;
+    for (c = 0; c < numOfCols; c++) {
+        row[c] *= model->invMu[c];
+        sum += pow(row[c],2);
     }
-    deepClone(APrime, A);
+    sum = sqrt(sum);
+    if (sum != 0){
+        for (c = 0; c < numOfCols; c++) {
+            row[c] = row[c] / sum;
+        }
+    }
+}
 
-    do {        
-        maxValInd = maxOffDiagonalValue(A);      
-        maxRow = maxValInd[0];
-        maxCol = maxValInd[1];
-        free(maxValInd);
+void predictPoints(spkModel *model, double **points, int numOfPoints, int *labels) {
+    /*assigns every point to the closest of the model's centroids*/
+    int i;
+    double *row = (double *)calloc(model->k, sizeof(double));
+    errorAssert(row != NULL,0);
+    for (i = 0; i < numOfPoints; i++) {
+        embedPoint(model, points[i], row);
+        labels[i] = nearestCentroid(row, model->centroids, model->k, model->k);
+    }
+    free(row);
+}
+
+void freeModel(spkModel *model) {
+    /*frees what buildModel allocated, points and centroids are not owned*/
+    free(model->dinv);
+    free(model->U);
+    free(model->invMu);
+    free(model->landmarks);
+    model->dinv = model->U = model->invMu = NULL;
+    model->landmarks = NULL;
+}
 
-        if (A[maxRow][maxCol] == 0) { /*matrix is already diagonal*/
+void printPredictions(spkModel *model, char *path) {
+    /*reads new points from path and prints their labels in one line*/
+    FILE *file;
+    double **points;
+    int i, numOfPoints, dim, *labels;
+
+    file = fopen(path, "r");
+    points = readVectors(file, &numOfPoints, &dim);
+    fclose(file);
+    errorAssert(dim == model->dim,1);
+    labels = (int *)calloc(numOfPoints, sizeof(int));
+    errorAssert(labels != NULL,0);
+    predictPoints(model, points, numOfPoints, labels);
+    printf("\n");
+    for (i = 0; i < numOfPoints; i++) {
+        printf("%d%s", labels[i], i < numOfPoints - 1 ? "," : "");
+    }
+    free(labels);
+    free2DDoubleArray(points, numOfPoints);
+}
+
+int* parseKList(char *list, int *numOfKs) {
+    /*parses a sweep list such as "2,3,5" or "2-8" (or both, "2-4,8")*/
+    int count = 0, from, to, pass, *ks = NULL;
+    char *str, *end;
+
+    for (pass = 0; pass < 2; pass++) { /*first pass counts, second fills*/
+        str = list;
+        count = 0;
+        while (*str != '\0') {
+            from = (int)strtol(str, &end, 10);
+            errorAssert(end != str && from > 0,1);
+            to = from;
+            if (*end == '-') {
+                str = end + 1;
+                to = (int)strtol(str, &end, 10);
+                errorAssert(end != str && to >= from,1);
+            }
+            for (; from <= to; from++) {
+                if (ks != NULL) {
+                    ks[count] = from;
+                }
+                count++;
+            }
+            errorAssert(*end == ',' || *end == '\0',1);
+            str = *end == ',' ? end + 1 : end;
+        }
+        if (pass == 0) {
+            errorAssert(count > 0,1);
+            ks = (int *)calloc(count, sizeof(int));
+            errorAssert(ks != NULL,0);
+        }
+    }
+    *numOfKs = count;
+    return ks;
+}
+
+void runSweepK(sweepResult *result) {
+    /*runs kmeans for one k of the sweep, from the first k rows of its T
+    matrix like the spk goal does*/
+    int i, j;
+    double **T, start = PROFILE_NOW();
+    kmeansState state;
+
+    errorAssert(result->k < numOfVectors,1);
+    T = buildTMatrix(result->k);
+    result->centroids = (double **)calloc(result->k, sizeof(double *));
+    errorAssert(result->centroids != NULL,0);
+    for (i = 0; i < result->k; i++) {
+        result->centroids[i] = (double *)calloc(result->k, sizeof(double));
+        errorAssert(result->centroids[i] != NULL,0);
+        for (j = 0; j < result->k; j++) {
+            result->centroids[i][j] = T[i][j];
+        }
+    }
+
+    initKmeansState(&state, T, numOfVectors, result->k, result->centroids, result->k);
+    runKmeansState(&state, max_iter);
+    result->inertia = kmeansInertia(&state);
+    result->iterations = state.iteration;
+    freeKmeansState(&state);
+    free2DDoubleArray(T, numOfVectors);
+    PROFILE_STAGE("sweep_k", start, result->k);
+}
+
+#ifdef SPK_THREADS
+typedef struct sweepQueue {
+    sweepResult *results;
+    int numOfKs, next;
+    pthread_mutex_t lock;
+} sweepQueue;
+
+void* sweepWorker(void *arg) {
+    /*takes the next k of the sweep until none are left*/
+    sweepQueue *queue = (sweepQueue *)arg;
+    int ind;
+    while (1) {
+        pthread_mutex_lock(&queue->lock);
+        ind = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (ind >= queue->numOfKs) {
             break;
         }
-        theta = calcTheta(A, maxRow, maxCol);
-        t = calcT(theta);
-        c = calcC(t);
-        s = calcS(t, c);
+        runSweepK(&queue->results[ind]);
+    }
+    return NULL;
+}
+#endif
+
+int defaultNumOfThreads() {
+    /*number of online cores, used when --threads is not given*/
+#ifdef SPK_THREADS
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+#else
+    return 1;
+#endif
+}
+
+void sweepK(sweepResult *results, int numOfKs, int numOfWorkers) {
+    /*runs kmeans for every k of the sweep concurrently, all of them share
+    the eigenpairs that eigengapHeuristic already computed*/
+    int i;
+#ifdef SPK_THREADS
+    sweepQueue queue;
+    pthread_t *workers;
 
-        createRotationMatrixP(P, maxRow, maxCol, c, s); /*creating P rotation matrix*/
-        
-        if (flag==2){
-            V2 = matrixMultiplication(V1, P); /*updating eigenvectors matrix*/
-            free2DDoubleArray(V1,numOfVectors);
-            flag=1;
+    if (numOfWorkers > numOfKs) {
+        numOfWorkers = numOfKs;
+    }
+    if (numOfWorkers > 1) {
+        queue.results = results;
+        queue.numOfKs = numOfKs;
+        queue.next = 0;
+        pthread_mutex_init(&queue.lock, NULL);
+        workers = (pthread_t *)calloc(numOfWorkers, sizeof(pthread_t));
+        errorAssert(workers != NULL,0);
+        for (i = 0; i < numOfWorkers; i++) {
+            errorAssert(pthread_create(&workers[i], NULL, sweepWorker, &queue) == 0,0);
         }
-        else {
-            V1 = matrixMultiplication(V2, P); /*updating eigenvectors matrix*/
-            free2DDoubleArray(V2,numOfVectors);
-            flag=2;
+        for (i = 0; i < numOfWorkers; i++) {
+            pthread_join(workers[i], NULL);
         }
+        free(workers);
+        pthread_mutex_destroy(&queue.lock);
+        return;
+    }
+#else
+    (void)numOfWorkers;
+#endif
+    for (i = 0; i < numOfKs; i++) {
+        runSweepK(&results[i]);
+    }
+}
 
-        updateAPrime(A, APrime, maxRow, maxCol, c, s); /*updating A'*/
-        isConverged = checkConvergence(A, APrime); /*checks convergence*/
+void printSweep(sweepResult *results, int numOfKs) {
+    /*prints the eigengaps, then for each k a "k,inertia,iterations" line
+    followed by its centroids*/
+    int i, limit = (int) floor(numOfEigenVals / 2);
+    printMatrix(&eigenGaps, 1, limit);
+    for (i = 0; i < numOfKs; i++) {
+        printf("\n%d,%.4f,%d\n", results[i].k, results[i].inertia, results[i].iterations);
+        printMatrix(results[i].centroids, results[i].k, results[i].k);
+    }
+}
 
-        /* A = APrime, deep clone */
-        deepClone(A,APrime);
-        count++; /*iterations count*/
+long jobCost(char *path) {
+    /*size of a job's input in bytes, 0 when it can't be read*/
+    FILE *file = fopen(path, "rb");
+    long cost = 0;
+    if (file != NULL) {
+        if (fseek(file, 0, SEEK_END) == 0) {
+            cost = ftell(file);
+        }
+        fclose(file);
     }
-    while ((isConverged==0)&&(count<100)); /*until convergence or 100 iterations*/
-    
-    V = flag==1 ? V2 : V1; /*Checks which Vn is the latest*/
+    return cost;
+}
 
-    free2DDoubleArray(P, numOfVectors);
-    free2DDoubleArray(APrime, numOfVectors);
+batchJob* readManifest(char *path, int *numOfJobs) {
+    /*reads a batch manifest, one "file,k,goal" job per line, blank lines
+    are skipped*/
+    FILE *file;
+    int count = 0, capacity = 16;
+    size_t bufferSize = READ_BUFFER_SIZE;
+    char *buffer, *field;
+    float jobK;
+    batchJob *jobs, *tmp;
+
+    file = fopen(path, "r");
+    errorAssert(file != NULL,1);
+    buffer = (char *)malloc(bufferSize);
+    jobs = (batchJob *)calloc(capacity, sizeof(batchJob));
+    errorAssert(buffer != NULL && jobs != NULL,0);
+    while (readLine(file, &buffer, &bufferSize) != NULL) {
+        field = strtok(buffer, ",\r\n");
+        if (field == NULL) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            tmp = (batchJob *)realloc(jobs, capacity*sizeof(batchJob));
+            errorAssert(tmp != NULL,0);
+            jobs = tmp;
+        }
+        jobs[count].path = (char *)malloc(strlen(field) + 1);
+        errorAssert(jobs[count].path != NULL,0);
+        strcpy(jobs[count].path, field);
+        field = strtok(NULL, ",\r\n");
+        errorAssert(field != NULL && sscanf(field, "%f", &jobK) == 1,1);
+        jobs[count].k = (int)jobK;
+        errorAssert(jobK - jobs[count].k == 0 && jobs[count].k >= 0,1);
+        field = strtok(NULL, ",\r\n");
+        errorAssert(field != NULL,1);
+        jobs[count].goal = (char *)malloc(strlen(field) + 1);
+        errorAssert(jobs[count].goal != NULL,0);
+        strcpy(jobs[count].goal, field);
+        jobs[count].index = count;
+        jobs[count].cost = jobCost(jobs[count].path);
+        jobs[count].status = 1;
+        jobs[count].seconds = 0;
+        count++;
+    }
+    fclose(file);
+    free(buffer);
+    *numOfJobs = count;
+    return jobs;
+}
 
-    if (toPrint==0) { /*if further calculations are necessary*/
-        return A;
+void freeJobs(batchJob *jobs, int numOfJobs) {
+    int i;
+    for (i = 0; i < numOfJobs; i++) {
+        free(jobs[i].path);
+        free(jobs[i].goal);
     }
-    else { /*if goal was jacobi, only need to be printed*/
-        printJacobi(A, V);
-        /*free2DDoubleArray(A, numOfVectors);*/
-        return NULL;
+    free(jobs);
+}
+
+int compareJobCosts(const void *a, const void *b) {
+    /*larger inputs first, then manifest order*/
+    const batchJob *jobA = *(batchJob * const *)a, *jobB = *(batchJob * const *)b;
+    if (jobA->cost != jobB->cost) {
+        return jobA->cost < jobB->cost ? 1 : -1;
     }
-}  
+    return jobA->index - jobB->index;
+}
 
-int compareEigenVectors(const void *a, const void *b) {
-    /*comperator of vectors for quicksort*/
-    struct eigenVector *eva = (struct eigenVector *) a;
-    struct eigenVector *evb = (struct eigenVector *) b;
-    double diff = eva->eigenVal - evb->eigenVal; /*by eigen values*/
-    if (diff==0){
-        return eva->columnIndex - evb->columnIndex; /*then, by index*/
+#ifndef _WIN32
+void runJob(batchJob *job, char *outPath) {
+    /*runs one job in a forked worker with its output going to outPath,
+    errorAssert ends only this worker with exit status 1*/
+    FILE *file;
+    char jobCheckpoint[EIGEN_CACHE_PATH_LEN];
+
+    inWorker = 1;
+    profiling = 0;
+    errorAssert(freopen(outPath, "w", stdout) != NULL,0);
+    k = job->k;
+    goal = job->goal;
+    errorAssert(strcmp(goal,"batch")!=0,1);
+    normalizeOptions(); /*per job, the worker's copy of the options*/
+    file = fopen(job->path, "r");
+    readFile(file);
+    fclose(file);
+    reserveWorkspace(planWorkspace(goal, NULL));
+    if (checkpointPath != NULL) { /*<prefix>.<manifest index>, so --resume finds them again*/
+        errorAssert(strlen(checkpointPath) + 16 < EIGEN_CACHE_PATH_LEN,1);
+        sprintf(jobCheckpoint, "%s.%d", checkpointPath, job->index);
+        checkpointPath = jobCheckpoint;
+        startCheckpoints();
     }
-    else{
-        return diff > 0 ? 1 : -1; 
-    }    
+    runGoal();
+    if (checkpointPath != NULL) {
+        stopCheckpoints();
+    }
+    freeMemory();
+    releaseWorkspace();
+    fflush(stdout);
+    _exit(0);
+}
+#endif
+
+double runBatch(batchJob *jobs, int numOfJobs, int numOfWorkers, char *outDir) {
+    /*runs every job in its own forked worker, at most numOfWorkers at a time.
+    The pipeline keeps its state in globals and exits on errors, so jobs
+    are isolated in processes rather than threads. A free slot takes the
+    next job as soon as one finishes and the largest inputs go first, so
+    a big job doesn't start last and hold up the whole batch. Returns the
+    wall time in seconds*/
+    double begin = profileNow();
+#ifndef _WIN32
+    int i, next = 0, running = 0, status;
+    pid_t pid, *pids;
+    batchJob **order;
+    char path[EIGEN_CACHE_PATH_LEN];
+    struct timespec pollDelay;
+
+    order = (batchJob **)calloc(numOfJobs + 1, sizeof(batchJob *));
+    pids = (pid_t *)calloc(numOfJobs + 1, sizeof(pid_t));
+    errorAssert(order != NULL && pids != NULL,0);
+    pollDelay.tv_sec = 0;
+    pollDelay.tv_nsec = 1000000; /*1ms, next to jobs that run for seconds*/
+    for (i = 0; i < numOfJobs; i++) {
+        order[i] = &jobs[i];
+    }
+    qsort(order, numOfJobs, sizeof(batchJob *), compareJobCosts);
+    errorAssert(strlen(outDir) + 16 < EIGEN_CACHE_PATH_LEN,1);
+    fflush(stdout); /*or the workers would flush it again*/
+    while (next < numOfJobs || running > 0) {
+        if (next < numOfJobs && running < numOfWorkers) {
+            sprintf(path, "%s/%d.txt", outDir, order[next]->index);
+            order[next]->seconds = profileNow();
+            pid = fork();
+            errorAssert(pid >= 0,0);
+            if (pid == 0) {
+                runJob(order[next], path);
+            }
+            pids[order[next]->index] = pid;
+            next++;
+            running++;
+            continue;
+        }
+        /*polls only our own workers, waiting on any child would reap the
+        children of an embedding app (the Python module) too*/
+        for (i = 0; i < numOfJobs; i++) {
+            if (pids[i] == 0) {
+                continue;
+            }
+            pid = waitpid(pids[i], &status, WNOHANG);
+            errorAssert(pid >= 0,0);
+            if (pid == 0) { /*still running*/
+                continue;
+            }
+            jobs[i].seconds = (profileNow() - jobs[i].seconds) / 1e6;
+            jobs[i].status = WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+            pids[i] = 0;
+            running--;
+        }
+        if (next >= numOfJobs || running >= numOfWorkers) {
+            nanosleep(&pollDelay, NULL);
+        }
+    }
+    free(order);
+    free(pids);
+#else
+    (void)jobs;
+    (void)numOfJobs;
+    (void)numOfWorkers;
+    (void)outDir;
+    errorAssert(0==1,1); /*no fork, batch needs a POSIX build*/
+#endif
+    return (profileNow() - begin) / 1e6;
 }
 
-void sortEigenVectorsAndValues() {
-    /*sorts eigen vecctors using quicksort 
-    and sorts eigen values accordingly*/
+void printBatch(batchJob *jobs, int numOfJobs, double seconds) {
+    /*prints "index,status,seconds" per job (status 0 when it ran, 1 when it
+    failed) and then "jobs,seconds,jobs per second"*/
     int i;
-    eigenVectors = (eigenVector *)calloc(numOfVectors, numOfVectors*sizeof(eigenVector));
-    errorAssert(eigenVectors != NULL,0);
-    for (i = 0; i < numOfVectors; i++) { /*sets eigenvector's attributes*/
-        eigenVectors[i].columnIndex = i;
-        eigenVectors[i].eigenVal = eigenVals[i];
+    for (i = 0; i < numOfJobs; i++) {
+        printf("%d,%d,%.4f\n", jobs[i].index, jobs[i].status, jobs[i].seconds);
     }
-    
-    /*sorting*/
-    qsort(eigenVectors, numOfVectors, sizeof(eigenVector), compareEigenVectors);
-    for (i = 0; i < numOfVectors; i++) {
-        eigenVals[i] = eigenVectors[i].eigenVal;
+    printf("%d,%.4f,%.4f", numOfJobs, seconds, seconds > 0 ? numOfJobs / seconds : 0.0);
+}
+
+double profileNow() {
+    /*monotonic microseconds since profileStart*/
+#if !defined(_WIN32) && defined(CLOCK_MONOTONIC)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec*1e6 + now.tv_nsec/1e3 - profileOrigin;
+#else
+    return (double)clock() * 1e6 / CLOCKS_PER_SEC - profileOrigin;
+#endif
+}
+
+void profileStart(char *jsonPath, char *traceFilePath) {
+    /*turns profiling on when a report or trace path is given, either as
+    arguments or by the SPKMEANS_PROFILE and SPKMEANS_TRACE variables*/
+    profilePath = jsonPath != NULL ? jsonPath : getenv("SPKMEANS_PROFILE");
+    tracePath = traceFilePath != NULL ? traceFilePath : getenv("SPKMEANS_TRACE");
+    profiling = (profilePath != NULL) || (tracePath != NULL);
+    numOfProfileEvents = numOfProfileCounters = numOfDroppedEvents = 0;
+    free(profileChanges);
+    profileChanges = NULL;
+    numOfProfileChanges = 0;
+    profileOrigin = 0;
+    if (profiling) {
+        profileOrigin = profileNow();
     }
 }
 
-int eigengapHeuristic(){
-    /*calculates eigengaps for eigengap heuristic and calculates k*/
-    int i, limit, k=0;
-    double maxGap = -1.0;
-    double **A;
-    
-    A = jacobi(laplacianNorm(), 0); /*not for printing*/
+void profileStage(const char *name, double start, long arg) {
+    /*records a finished stage, safe to call from the sweep workers*/
+    double end = profileNow();
+#ifdef SPK_THREADS
+    pthread_mutex_lock(&profileLock);
+#endif
+    if (numOfProfileEvents < PROFILE_MAX_EVENTS) {
+        profileEvents[numOfProfileEvents].name = name;
+        profileEvents[numOfProfileEvents].start = start;
+        profileEvents[numOfProfileEvents].duration = end - start;
+        profileEvents[numOfProfileEvents].arg = arg;
+        numOfProfileEvents++;
+    }
+    else {
+        numOfDroppedEvents++;
+    }
+#ifdef SPK_THREADS
+    pthread_mutex_unlock(&profileLock);
+#endif
+}
 
-    eigenVals = (double *)calloc(numOfVectors, sizeof(double));
-    for (i = 0; i < numOfVectors; i++) {
-        eigenVals[i] = A[i][i]; /*eigenvals are on the diagonal line*/
+void profileCount(const char *name, double value) {
+    /*sets a named counter, the last value of a counter is reported*/
+    int i;
+    for (i = 0; i < numOfProfileCounters && strcmp(profileCounters[i].name, name) != 0; i++);
+    if (i == PROFILE_MAX_COUNTERS) {
+        return;
     }
-    sortEigenVectorsAndValues(); /*sorting eigenvectors and eigenvals*/
-    eigenGaps = (double *)calloc(numOfVectors - 1, sizeof(double));
-    for (i = 0; i < numOfVectors - 1; i++) {
-        /*calculates eigen gaps*/
-        eigenGaps[i] = fabs(eigenVals[i]-eigenVals[i+1]);
+    if (i == numOfProfileCounters) {
+        profileCounters[i].name = name;
+        numOfProfileCounters++;
     }
-    limit = (int) floor(numOfVectors / 2);
-    for (i = 0; i < limit; i++) { /*finds k*/
-        if (eigenGaps[i] > maxGap) {
-            maxGap = eigenGaps[i];
-            k = i;
-        }
+    profileCounters[i].value = value;
+}
+
+void profileChange(int numOfChanges) {
+    /*appends the centroid changes of one kmeans iteration*/
+    int *tmp;
+    if ((numOfProfileChanges & (numOfProfileChanges - 1)) == 0) { /*grows at powers of two*/
+        tmp = (int *)realloc(profileChanges, (numOfProfileChanges ? 2*numOfProfileChanges : 1)*sizeof(int));
+        errorAssert(tmp != NULL,0);
+        profileChanges = tmp;
     }
-    free2DDoubleArray(A, numOfVectors);
-    return k + 1; /*becuase count in intructions starts from 1*/
+    profileChanges[numOfProfileChanges++] = numOfChanges;
 }
 
-void normalizeUMatrix() {
-    /*normalizes U matrix to T matrix according to formula*/
-    int i,j;
-    double sum;
-    for (i = 0; i < numOfVectors; i++){
-        sum = 0;
-        for (j = 0; j < k; j++){
-            sum += pow(U[i][j],2);
-        }
-        sum = sqrt(sum);
-        if (sum != 0){
-            for (j = 0; j < k; j++){
-                U[i][j] = U[i][j] / sum;
+long peakRss() {
+    /*peak resident set size in kilobytes, -1 where it is not available.
+    Linux keeps ru_maxrss across exec, so a child of a large process would
+    report its parent's peak, VmHWM starts over with the new image*/
+#ifndef _WIN32
+    struct rusage usage;
+    FILE *status = fopen("/proc/self/status", "r");
+    char line[256];
+    long peak = -1;
+
+    if (status != NULL) {
+        while (fgets(line, sizeof(line), status) != NULL) {
+            if (strncmp(line, "VmHWM:", 6) == 0) {
+                peak = strtol(line + 6, NULL, 10);
+                break;
             }
         }
+        fclose(status);
+    }
+    if (peak < 0 && getrusage(RUSAGE_SELF, &usage) == 0) {
+        peak = usage.ru_maxrss;
     }
+    return peak;
+#else
+    return -1;
+#endif
 }
 
-void createUMatrix() {
-    /*takes k-smallest-eigenvals vectors from V matrix*/
-    int i,j;
-    squareMatrixTranspose(V, numOfVectors); /*in order to place vectors as rows*/
+void profileFinish(char *profileGoal) {
+    /*writes the JSON report and the Chrome trace, then turns profiling off*/
+    FILE *file;
+    int i;
 
-    U = (double **)calloc(numOfVectors, k*sizeof(double));
-    errorAssert(U != NULL,0);
-    for (i = 0; i < numOfVectors; i++) {
-        U[i] = (double *)calloc(k, sizeof(double));
-        errorAssert(U[i] != NULL,0);
-        for (j = 0; j < k; j++){
-            /*takes relevant part of vectors and puts it as a column*/
-            U[i][j] = V[eigenVectors[j].columnIndex][i]; 
+    if (!profiling) {
+        return;
+    }
+    if (profilePath != NULL && (file = fopen(profilePath, "w")) != NULL) {
+        fprintf(file, "{\"goal\":\"%s\",", profileGoal);
+        fprintf(file, "\"total_us\":%.1f,\"peak_rss_kb\":%ld,\"dropped_events\":%d,",
+            profileNow(), peakRss(), numOfDroppedEvents);
+        fprintf(file, "\"stages\":[");
+        for (i = 0; i < numOfProfileEvents; i++) {
+            fprintf(file, "%s{\"name\":\"%s\",\"start_us\":%.1f,\"duration_us\":%.1f,\"arg\":%ld}",
+                i ? "," : "", profileEvents[i].name, profileEvents[i].start,
+                profileEvents[i].duration, profileEvents[i].arg);
+        }
+        fprintf(file, "],\"counters\":{");
+        for (i = 0; i < numOfProfileCounters; i++) {
+            fprintf(file, "%s\"%s\":%.17g", i ? "," : "", profileCounters[i].name,
+                profileCounters[i].value);
         }
+        fprintf(file, "},\"kmeans_changes\":[");
+        for (i = 0; i < numOfProfileChanges; i++) {
+            fprintf(file, "%s%d", i ? "," : "", profileChanges[i]);
+        }
+        fprintf(file, "]}\n");
+        fclose(file);
+    }
+    if (tracePath != NULL && (file = fopen(tracePath, "w")) != NULL) {
+        /*complete ("X") events, sweep runs get one row per k*/
+        fprintf(file, "{\"traceEvents\":[");
+        for (i = 0; i < numOfProfileEvents; i++) {
+            fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.1f,\"dur\":%.1f,"
+                "\"pid\":1,\"tid\":%ld,\"args\":{\"arg\":%ld}}", i ? "," : "",
+                profileEvents[i].name, profileEvents[i].start, profileEvents[i].duration,
+                strcmp(profileEvents[i].name, "sweep_k")==0 ? 1 + profileEvents[i].arg : 0,
+                profileEvents[i].arg);
+        }
+        fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+        fclose(file);
     }
-    normalizeUMatrix();
+    free(profileChanges);
+    profileChanges = NULL;
+    numOfProfileChanges = 0;
+    profiling = 0;
 }
 
 void free2DDoubleArray(double ** arr, int numOfElements) {
     /*frees memory of 2D array*/
     int i;
+    if (arr == NULL) { /*never allocated, e.g. on an eigen cache hit*/
+        return;
+    }
     for (i = 0; i < numOfElements; i++) {
         free(arr[i]);
     }
     free(arr);
 }
 
-void free2DIntArray(int ** arr, int numOfElements) {
-    /*frees memory of 2D array*/
+void freeSpectralMemory() {
+    /*frees the buffers left by the spectral stage (eigengapHeuristic)*/
+    free(eigenVals);
+    free(eigenGaps);
+    free(ddg);
+    if (eigenCache != NULL) { /*V rows point into the mapped cache*/
+        free(V);
+        unmapFile(eigenCache, eigenCacheSize);
+        eigenCache = NULL;
+    }
+    else {
+        freeDenseMatrix(V);
+    }
+    free(eigenVectors);
+    free(landmarkRows);
+    free(landmarkDinv);
+    free(landmarkInvA);
+    free(landmarkBasis);
+    /*a session runs the stage again, and not every path sets all of them*/
+    landmarkRows = NULL;
+    landmarkDinv = landmarkInvA = landmarkBasis = NULL;
+    eigenVals = eigenGaps = ddg = NULL;
+    V = NULL;
+    eigenVectors = NULL;
+}
+
+void parseOptions(int argc, char *argv[]) {
+    /*parses the optional --name=value arguments that follow the input file*/
     int i;
-    for (i = 0; i < numOfElements; i++) {
-        free(arr[i]);
+    for (i = 4; i < argc; i++) {
+        if (strncmp(argv[i], "--cache=", 8)==0) {
+            cacheDir = argv[i] + 8; /*directory of the eigen cache*/
+        }
+        else if (strncmp(argv[i], "--ks=", 5)==0) {
+            sweepKs = argv[i] + 5; /*k values of the sweep goal*/
+        }
+        else if (strncmp(argv[i], "--landmarks=", 12)==0) {
+            numOfLandmarks = (int)strtol(argv[i] + 12, NULL, 10);
+            errorAssert(numOfLandmarks > 1,1); /*Nystrom landmark count*/
+        }
+        else if (strncmp(argv[i], "--scratch=", 10)==0) {
+            scratchDir = argv[i] + 10; /*directory of the n x n scratch files*/
+        }
+        else if (strncmp(argv[i], "--profile=", 10)==0) {
+            profilePath = argv[i] + 10; /*JSON report of the stage timers*/
+        }
+        else if (strncmp(argv[i], "--trace=", 8)==0) {
+            tracePath = argv[i] + 8; /*Chrome trace of the same stages*/
+        }
+        else if (strncmp(argv[i], "--predict=", 10)==0) {
+            predictPath = argv[i] + 10; /*new points to label after spk*/
+        }
+        else if (strncmp(argv[i], "--outdir=", 9)==0) {
+            batchDir = argv[i] + 9; /*directory of the batch job outputs*/
+        }
+        else if (strncmp(argv[i], "--checkpoint=", 13)==0) {
+            checkpointPath = argv[i] + 13; /*periodic jacobi and kmeans state*/
+        }
+        else if (strncmp(argv[i], "--checkpoint-every=", 19)==0) {
+            checkpointSeconds = atof(argv[i] + 19);
+            errorAssert(checkpointSeconds >= 0,1);
+        }
+        else if (strcmp(argv[i], "--resume")==0) {
+            resumeRun = 1; /*continues from the checkpoints that match*/
+        }
+        else if (strncmp(argv[i], "--warm=", 7)==0) {
+            warmPath = argv[i] + 7; /*eigenvectors to start jacobi from*/
+        }
+        else if (strncmp(argv[i], "--rotations=", 12)==0) {
+            maxRotations = (int)strtol(argv[i] + 12, NULL, 10);
+            errorAssert(maxRotations > 0,1); /*cap of the exact jacobi*/
+        }
+        else if (strncmp(argv[i], "--graph=", 8)==0) {
+            graphPath = argv[i] + 8; /*saved wam and degrees to extend*/
+        }
+        else if (strncmp(argv[i], "--coreset=", 10)==0) {
+            coresetRatio = atof(argv[i] + 10); /*representatives per point*/
+            errorAssert(coresetRatio > 0 && coresetRatio <= 1,1);
+        }
+        else if (strcmp(argv[i], "--labels")==0) {
+            showLabels = 1; /*spk also prints the cluster of every point*/
+        }
+        else if (strcmp(argv[i], "--pipeline")==0) {
+            pipelineIngest = 1; /*overlaps reading with the wam and degrees*/
+        }
+        else if (strcmp(argv[i], "--plan")==0) {
+            planOnly = 1; /*prints the predicted peak bytes and exits*/
+        }
+        else if (strncmp(argv[i], "--workers=", 10)==0) {
+            kmeansWorkers = (int)strtol(argv[i] + 10, NULL, 10);
+            errorAssert(kmeansWorkers > 0,1); /*processes of the spk kmeans*/
+        }
+        else if (strncmp(argv[i], "--threads=", 10)==0) {
+            numOfThreads = (int)strtol(argv[i] + 10, NULL, 10);
+            errorAssert(numOfThreads > 0,1);
+        }
+        else {
+            errorAssert(0==1,1); /*unknown option*/
+        }
     }
-    free(arr);
+}
+
+void normalizeOptions() {
+    /*drops the options that don't apply to goal and rejects the ones that
+    conflict, for a single run and for every batch job. Only the graph
+    goals can start before the whole file is read, and the exact spectral
+    goals can also start from a saved graph*/
+    int isGraphGoal;
+    if (strcmp(goal,"spk")!=0) {
+        coresetRatio = 0;
+    }
+    errorAssert(coresetRatio == 0 || numOfLandmarks == 0,1);
+    if (warmPath != NULL || coresetRatio > 0) { /*the eigenpairs depend on more than the input*/
+        cacheDir = NULL;
+    }
+    isGraphGoal = strcmp(goal,"wam")==0 || strcmp(goal,"ddg")==0 || strcmp(goal,"lnorm")==0;
+    errorAssert(!pipelineIngest || isGraphGoal,1); /*only they start before the file is read*/
+    if (graphPath != NULL && !isGraphGoal && !((strcmp(goal,"spk")==0
+        || strcmp(goal,"sweep")==0) && numOfLandmarks == 0 && cacheDir == NULL
+        && coresetRatio == 0)) {
+        graphPath = NULL;
+    }
+    pipelineIngest = pipelineIngest && isGraphGoal && graphPath == NULL;
 }
 
 void freeMemory() {
     free2DDoubleArray(vectors, numOfVectors);
     if (strcmp(goal,"wam")==0){
-        free2DDoubleArray(wam, numOfVectors);
+        freeSymMatrix(&wam);
     }
     else if (strcmp(goal,"ddg")==0){
-        free2DDoubleArray(wam, numOfVectors);
-        free2DDoubleArray(ddg, numOfVectors);
+        free(ddg);
+        ddg = NULL; /*diagonalDegreeMatrix only sums a NULL ddg*/
     }
     else if (strcmp(goal,"lnorm")==0){
-        free2DDoubleArray(wam, numOfVectors);
-        free2DDoubleArray(ddg, numOfVectors);
-        free2DDoubleArray(lnorm, numOfVectors);
+        free(ddg);
+        ddg = NULL;
+        freeSymMatrix(&lnorm);
     }
     else if (strcmp(goal,"jacobi")==0){
-        free2DDoubleArray(V, numOfVectors);
+        freeDenseMatrix(V);
+        freeSymMatrix(&lnorm); /*holds the packed input matrix*/
+    }
+    else if (strcmp(goal,"sweep")==0){
+        freeSpectralMemory();
     }
     else {
-        free(eigenVals);
-        free(eigenGaps);
+        freeSpectralMemory();
         free2DDoubleArray(centroids, k);
-        free2DDoubleArray(wam, numOfVectors);
-        free2DDoubleArray(ddg, numOfVectors);
+        free(pointWeights);
+        free(coresetMap);
+        free(pointLabels);
         /*free2DDoubleArray(lnorm, numOfVectors);*/
-        free2DDoubleArray(V, numOfVectors);
         /*free2DDoubleArray(U, numOfVectors);*/
-        free2DIntArray(clusters, k);
-        free(clustersSizes);
-        free(eigenVectors);
     }
 }
 
-int main(int argc, char *argv[]) {
-    FILE *file;
-    int i, counter = 1;
-
-    errorAssert(argc == 4,1); /*Checks if we have the right amount of args*/ 
-    
-    errorAssert(sscanf(argv[1], "%f", &rawK) == 1,1);
-    k = (int)rawK;
-    errorAssert(rawK - k == 0 && k >= 0,1); /*checks if k is a non-negative int*/
-
-    file = fopen(argv[3],"r");
-    readFile(file);
-    fclose(file);
+void runGoal() {
+    /*runs and prints the goal on the vectors that were read*/
+    int i, numOfKs, *ks;
+    double start;
+    sweepResult *results;
+    spkModel model;
 
-    goal = argv[2];
     if (strcmp(goal,"spk")==0){
-        int calcK = eigengapHeuristic();
+        int calcK;
+        if (coresetRatio > 0) {
+            buildCoreset(coresetSize(numOfVectors));
+        }
+        calcK = eigengapHeuristic();
         if (k==0) {
             k = calcK;
         }
+        if (predictPath != NULL) { /*the training points stay with the model*/
+            buildModel(&model, vectors, numOfVectors, dimension, k);
+            vectors = NULL;
+        }
         dimension = k;
 
         createUMatrix();
         assignUToVectors();
         initCentroids();
-
-        clusters = (int **)calloc(k, numOfVectors*sizeof(int));
-        errorAssert(clusters != NULL,0);
-        for (i = 0; i < k; i++) { 
-            clusters[i] = (int *)calloc(numOfVectors, sizeof(int));
-            errorAssert(clusters[i] != NULL,0);
+        runKmeans();
+        printMatrix(centroids, k, dimension);
+        if (showLabels) {
+            printLabels();
+        }
+        if (predictPath != NULL) {
+            model.centroids = centroids;
+            printPredictions(&model, predictPath);
+            free2DDoubleArray(model.points, model.numOfPoints);
+            freeModel(&model);
+        }
+    } 
+    else if (strcmp(goal,"sweep")==0){
+        eigengapHeuristic(); /*eigenpairs are computed once for all k*/
+        if (sweepKs != NULL) {
+            ks = parseKList(sweepKs, &numOfKs);
         }
-        clustersSizes = (int *)calloc(k, sizeof(int));
-        errorAssert(clustersSizes != NULL,0);
+        else { /*1..k, or the eigengap search range when k is 0*/
+            numOfKs = k==0 ? (int) floor(numOfEigenVals / 2) : k;
+            ks = (int *)calloc(numOfKs, sizeof(int));
+            errorAssert(ks != NULL,0);
+            for (i = 0; i < numOfKs; i++) {
+                ks[i] = i + 1;
+            }
+        }
+        results = (sweepResult *)calloc(numOfKs, sizeof(sweepResult));
+        errorAssert(results != NULL,0);
+        for (i = 0; i < numOfKs; i++) {
+            results[i].k = ks[i];
+        }
+
+        start = PROFILE_NOW();
+        sweepK(results, numOfKs, numOfThreads > 0 ? numOfThreads : defaultNumOfThreads());
+        PROFILE_STAGE("sweep", start, numOfKs);
+        printSweep(results, numOfKs);
 
-        while ((counter <= max_iter) && (changes > 0)) {
-            assignVectorToCluster();
-            updateCentroidValue();
-            counter += 1;
+        for (i = 0; i < numOfKs; i++) {
+            free2DDoubleArray(results[i].centroids, results[i].k);
         }
-        printMatrix(centroids, k, dimension);
+        free(results);
+        free(ks);
     } 
     else if (strcmp(goal,"wam")==0){
-        printMatrix(weightedAdjacencyMatrix(),numOfVectors,numOfVectors);
+        printSymMatrix(weightedAdjacencyMatrix());
     } 
     else if (strcmp(goal,"ddg")==0){
-        printMatrix(diagonalDegreeMatrix(1,1),numOfVectors,numOfVectors);
+        printDiagonalMatrix(diagonalDegreeMatrix(1),numOfVectors);
     } 
     else if (strcmp(goal,"lnorm")==0){
-        printMatrix(laplacianNorm(),numOfVectors,numOfVectors);
+        printSymMatrix(laplacianNorm());
     } 
     else if (strcmp(goal,"jacobi")==0){
-        jacobi(vectors, 1);
+        squareToSymMatrix(vectors, &lnorm, numOfVectors); /*input is symmetric*/
+        jacobi(&lnorm, 1);
     } 
     else{
         errorAssert(0==1,1); /*If the goal is unknown*/
     }
+}
+
+int main(int argc, char *argv[]) {
+    FILE *file;
+    int numOfJobs;
+    size_t arenaBytes, heapBytes;
+    double start;
+    batchJob *jobs;
+
+    errorAssert(argc >= 4,1); /*Checks if we have the right amount of args*/ 
+    parseOptions(argc, argv);
+    profileStart(profilePath, tracePath);
+    
+    errorAssert(sscanf(argv[1], "%f", &rawK) == 1,1);
+    k = (int)rawK;
+    errorAssert(rawK - k == 0 && k >= 0,1); /*checks if k is a non-negative int*/
+
+    goal = argv[2];
+    if (strcmp(goal,"batch")==0){ /*argv[3] is a manifest of jobs*/
+        errorAssert(warmPath == NULL && graphPath == NULL,1); /*one file for every job*/
+        errorAssert(!pipelineIngest,1); /*jobs read their whole input*/
+        jobs = readManifest(argv[3], &numOfJobs);
+        start = runBatch(jobs, numOfJobs,
+            numOfThreads > 0 ? numOfThreads : defaultNumOfThreads(), batchDir);
+        printBatch(jobs, numOfJobs, start);
+        freeJobs(jobs, numOfJobs);
+        return 0;
+    }
+
+    normalizeOptions();
+    start = PROFILE_NOW();
+    file = fopen(argv[3],"r");
+    if (pipelineIngest) {
+        measureFile(file, &numOfVectors, &dimension);
+    }
+    else {
+        readFile(file);
+        fclose(file);
+        PROFILE_STAGE("parse", start, numOfVectors);
+    }
+    if (profiling) {
+        profileCount("n", numOfVectors);
+        profileCount("d", dimension);
+    }
+
+    arenaBytes = planWorkspace(goal, &heapBytes);
+    if (planOnly) { /*dry run for schedulers, nothing is computed*/
+        printf("%lu", (unsigned long)(arenaBytes + heapBytes));
+        free2DDoubleArray(vectors, numOfVectors);
+        if (pipelineIngest) {
+            fclose(file);
+        }
+        return 0;
+    }
+    reserveWorkspace(arenaBytes);
+    if (checkpointPath != NULL) {
+        startCheckpoints();
+    }
+    if (pipelineIngest) {
+        ingestPipelined(file);
+        fclose(file);
+    }
+    else if (graphPath != NULL) {
+        updateGraph(graphPath);
+    }
+    if (graphIngested) {
+        if (strcmp(goal,"wam")==0) { /*keep only what the goal prints*/
+            free(ddg);
+            ddg = NULL;
+        }
+        else if (strcmp(goal,"ddg")==0) {
+            freeSymMatrix(&wam);
+        }
+    }
+    runGoal();
+    if (checkpointPath != NULL) {
+        stopCheckpoints();
+    }
 
+    profileFinish(goal);
     freeMemory();
+    releaseWorkspace();
     return 0;
 }
\ No newline at end of file
@@ -2,55 +2,327 @@
 #ifndef SPKMEANS_H_
 #define SPKMEANS_H_
 
+#define JACOBI_MAX_ROTATIONS 100
+#define READ_BUFFER_SIZE 1000
+#define DEGREE_TILE 256
+#define NYSTROM_ROTATIONS_PER_ENTRY 4
+#define NYSTROM_MIN_EIGENVAL 1e-10
+#define EIGEN_CACHE_MAGIC 0x43454b53u
+#define EIGEN_CACHE_VERSION 4
+#define EIGEN_CACHE_HEADER 8
+#define EIGEN_CACHE_PATH_LEN 4096
+#define GRAPH_MAGIC 0x48505247u
+#define GRAPH_VERSION 1
+#define GRAPH_HEADER 8
+#define WARM_MAGIC 0x4d524157u
+#define WARM_VERSION 1
+#define WARM_HEADER 4
+#define CHECKPOINT_MAGIC 0x4b504b43u
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_HEADER 10
+#define CHECKPOINT_JACOBI 1
+#define CHECKPOINT_KMEANS 2
+#define CHECKPOINT_SECONDS 60
+#define SCRATCH_MAX_BLOCKS 16
+#define ARENA_MAX_BLOCKS 32
+#define ARENA_ALIGN 64
+#define PROFILE_MAX_EVENTS 4096
+#define PROFILE_MAX_COUNTERS 32
+#define PIPELINE_QUEUE_BLOCKS 8
+#define KERNEL_MAX_DIM 8
+#define ASSIGN_BLOCK_MIN_K 16
+#define ASSIGN_BLOCK 4
+#define ROTATE_BLOCK 256
+#define KMEANS_STOP 0
+#define KMEANS_ASSIGN 1
+#define KMEANS_COORDINATOR -1
+#define ARENA_ROUND(bytes) (((bytes) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+
+#ifdef SPK_FLOAT32
+typedef float spkReal; /*storage of the kmeans kernels and Nystrom affinities*/
+#else
+typedef double spkReal;
+#endif
+
+/*squared distance of two vectors of length dim. The kernel tables hold
+the generic loop at 0 and a kernel unrolled for each dim up to
+KERNEL_MAX_DIM, DISTANCE_KERNEL picks one once for a whole loop*/
+typedef double (*distanceKernel)(double *vector1, double *vector2, int dim);
+typedef double (*realDistanceKernel)(spkReal *vector1, spkReal *vector2, int dim);
+#define DISTANCE_KERNEL(table, dim) ((table)[(dim) <= KERNEL_MAX_DIM ? (dim) : 0])
+
 typedef struct eigenVector {
     double eigenVal;
     int columnIndex;
 } eigenVector;  
 
-int k, dimension, numOfVectors, changes, max_iter;
-float rawK, rawMaxIter;
-double *eigenVals, *eigenGaps;
-double **vectors, **centroids, **wam, **ddg, **lnorm, **V, **U;
-int **clusters, *clustersSizes;
-char *goal;
-eigenVector *eigenVectors;
+typedef struct symMatrix {
+    double **rows; /*rows[i] holds entries (i,0..i), the upper triangle is implied*/
+    double *data; /*contiguous storage of the rows*/
+    int n;
+} symMatrix;
+
+#define SYM_ENTRY(mat, i, j) ((i) >= (j) ? (mat)->rows[i][j] : (mat)->rows[j][i])
+
+typedef struct arenaBlock {
+    size_t offset, size;
+    int used;
+} arenaBlock;
+
+typedef struct workspace {
+    char *base;
+    size_t size, clean; /*bytes from clean on were never handed out*/
+    arenaBlock blocks[ARENA_MAX_BLOCKS]; /*in offset order, covering the arena*/
+    int numOfBlocks;
+} workspace;
+
+typedef struct profileEvent {
+    const char *name;
+    double start, duration; /*microseconds*/
+    long arg; /*stage specific, e.g. the k of a sweep run*/
+} profileEvent;
+
+typedef struct profileCounter {
+    const char *name;
+    double value;
+} profileCounter;
+
+/*stage timers cost a single branch when profiling is off*/
+#define PROFILE_NOW() (profiling ? profileNow() : 0.0)
+#define PROFILE_STAGE(name, start, arg) do { if (profiling) profileStage(name, start, arg); } while (0)
+
+typedef struct kmeansState {
+    double **points; /*numOfPoints x dim, not owned*/
+    double **centroids; /*k x dim, not owned, updated in place*/
+    double **sums; /*per cluster coordinate sums of the last assignment*/
+    spkReal *realPoints; /*packed copy of points for the distance kernels*/
+    spkReal *realCentroids; /*packed copy of centroids, refreshed on update*/
+    double *weights; /*per point weight, not owned, NULL when each counts once*/
+    double *mass; /*per cluster weight sums of the last assignment*/
+    int *counts, *labels;
+    int numOfPoints, dim, k, iteration, changes;
+} kmeansState;
+
+typedef struct kmeansTransport {
+    /*moves the messages of distributed kmeans between the coordinator and
+    its workers, the local one is forked workers on Unix socketpairs.
+    start runs kmeansWorker for every partition and returns only in the
+    coordinator; send and receive move size bytes to or from peer, a
+    worker index or KMEANS_COORDINATOR, and return 0 on failure*/
+    void (*start)(struct kmeansTransport *transport, kmeansState *state);
+    int (*send)(struct kmeansTransport *transport, int peer, void *data, size_t size);
+    int (*receive)(struct kmeansTransport *transport, int peer, void *data, size_t size);
+    void (*stop)(struct kmeansTransport *transport);
+    void *context; /*of the implementation*/
+    int numOfWorkers, rank; /*rank is KMEANS_COORDINATOR in the coordinator*/
+} kmeansTransport;
+
+typedef struct spkModel {
+    double **points; /*training points, numOfPoints x dim, not owned*/
+    int *landmarks; /*training point of each row after Nystrom, NULL for all points*/
+    double *dinv; /*D^-0.5 of the rows*/
+    double *U; /*numOfRows x k eigenvectors before normalization, row major*/
+    double *invMu; /*1 / eigenvalue of D^-0.5 W D^-0.5 per column, 0 if ~0*/
+    double **centroids; /*k x k, not owned*/
+    int numOfPoints, numOfRows, dim, k;
+} spkModel;
+
+typedef struct batchJob {
+    char *path, *goal;
+    int k, index, status; /*status is 0 when the job ran, 1 when it failed*/
+    long cost; /*input size in bytes, larger jobs start first*/
+    double seconds;
+} batchJob;
+
+typedef struct checkpoint {
+    char path[EIGEN_CACHE_PATH_LEN]; /*file of the snapshot being written*/
+    char *data; /*header and state, copied out of the compute loop*/
+    size_t size, capacity;
+    int pending, stop; /*pending while the writer has not finished it*/
+} checkpoint;
+
+typedef struct sweepResult {
+    double **centroids;
+    double inertia;
+    int k, iterations;
+} sweepResult;
+
+extern int k, dimension, numOfVectors, changes, max_iter;
+extern float rawK, rawMaxIter;
+extern double *eigenVals, *eigenGaps;
+extern double *ddg;
+extern double **vectors, **centroids, **V, **U;
+extern symMatrix wam, lnorm;
+extern char *goal, *cacheDir, *sweepKs, *scratchDir, *predictPath, *batchDir, *graphPath, *warmPath, *checkpointPath;
+extern int resumeRun;
+extern distanceKernel affinityKernels[], vectorKernels[];
+extern realDistanceKernel realKernels[];
+extern double coresetRatio;
+extern double *pointWeights;
+extern int *coresetMap, *pointLabels, numOfInputPoints, showLabels;
+extern double checkpointSeconds;
+extern int numOfThreads, maxRotations, numOfLandmarks, numOfEigenVals, kmeansWorkers;
+extern int *landmarkRows;
+extern double *landmarkDinv, *landmarkInvA, *landmarkBasis;
+extern eigenVector *eigenVectors;
+extern workspace arena;
+extern int planOnly, profiling, inWorker, pipelineIngest, graphIngested;
+extern char *profilePath, *tracePath;
 
 void errorAssert(int cond, int isInputError);
 int calcDimension(char buffer[]);
+char* readLine(FILE *file, char **buffer, size_t *size);
+double* parseVector(char *buffer, int cols);
+double** readVectors(FILE *file, int *numOfRows, int *numOfCols);
 void readFile(FILE *file);
 void assignUToVectors(void); 
 void initCentroids(void); 
+double affinityDistanceN(double *vector1, double *vector2, int dim);
+double vectorDistanceN(double *vector1, double *vector2, int dim);
+double realDistanceN(spkReal *vector1, spkReal *vector2, int dim);
+double vectorDistance(double *vector1, double *vector2, int dim);
 double distance(double *vector1, double *vector2);
+int nearestCentroid(double *vector, double **cents, int numOfCents, int dim);
 int closestCentroid(double *vector);
-void assignVectorToCluster(void); 
-double* calcCentroidForCluster(int clusterInd);
-void updateCentroidValue(void);
-void deepClone(double **a, double** b);
+double realDistance(spkReal *vector1, spkReal *vector2, int dim);
+int nearestRealCentroid(spkReal *vector, spkReal *cents, int numOfCents, int dim);
+void dotBlock(spkReal *points, spkReal *cents, int dim, double *dots, int stride);
+void dotRows(spkReal *points, int numOfRows, spkReal *cents, int numOfCols, int dim, double *dots, int stride);
+void assignBlocked(kmeansState *state);
+void initKmeansState(kmeansState *state, double **points, int numOfPoints,
+                     int dim, double **cents, int numOfCents);
+void assignPointsToClusters(kmeansState *state);
+void updateCentroids(kmeansState *state);
+void runKmeansState(kmeansState *state, int maxIter);
+double kmeansInertia(kmeansState *state);
+void freeKmeansState(kmeansState *state);
+void kmeansCheckpointHeader(kmeansState *state, unsigned int *header);
+int saveKmeansCheckpoint(kmeansState *state, unsigned int *header, int wait);
+int loadKmeansCheckpoint(kmeansState *state, unsigned int *header);
+void runKmeans(void);
+void partitionRows(int numOfRows, int numOfParts, int part, int *from, int *to);
+void kmeansWorker(kmeansTransport *transport, kmeansState *state);
+void distributedStep(kmeansState *state, kmeansTransport *transport);
+void stopWorkers(kmeansState *state, kmeansTransport *transport);
+int localMove(int fd, void *data, size_t size, int isSend);
+int localSend(kmeansTransport *transport, int peer, void *data, size_t size);
+int localReceive(kmeansTransport *transport, int peer, void *data, size_t size);
+void localStart(kmeansTransport *transport, kmeansState *state);
+void localStop(kmeansTransport *transport);
+void localTransport(kmeansTransport *transport, int numOfWorkers);
+int coresetSize(int n);
+void buildCoreset(int size);
+void printLabels(void);
+void* arenaAlloc(size_t bytes);
+int arenaFree(void *ptr);
+void reserveWorkspace(size_t bytes);
+void releaseWorkspace(void);
+size_t planWorkspace(char *planGoal, size_t *heapBytes);
+void* allocBlock(size_t bytes);
+void freeBlock(void *block);
+void* allocLarge(size_t count, size_t size);
+void freeLarge(void *block);
+double** allocDenseMatrix(int numOfRows, int numOfCols);
+void freeDenseMatrix(double **mat);
+void allocSymMatrix(symMatrix *mat, int n);
+void freeSymMatrix(symMatrix *mat);
+void squareToSymMatrix(double **square, symMatrix *mat, int n);
 void printMatrix(double** mat, int numOfRows, int numOfCols); 
+void printSymMatrix(symMatrix *mat);
 double** matrixMultiplication(double** a, double** b);
 void squareMatrixTranspose(double **matrix, int numOfRows);
 double calcWeightsForAdjacencyMatrix(double *vector1, double *vector2);
-double** weightedAdjacencyMatrix(void);
-double** diagonalDegreeMatrix(int calcWam, int toPrint);
-double** laplacianNorm(void);
-int* maxOffDiagonalValue(double** mat);
-double calcTheta(double **matrix, int i, int j);
+symMatrix* weightedAdjacencyMatrix(void);
+void degreeRowSums(double *degrees);
+double* diagonalDegreeMatrix(int toPrint);
+void printDiagonalMatrix(double *diag, int numOfRows);
+symMatrix* laplacianNorm(void);
+void measureFile(FILE *file, int *numOfRows, int *numOfCols);
+void graphRows(double **rows, int from, int to);
+void foldRows(double **rows, int from, int to);
+int blockEnd(int block);
+void graphBlock(double **rows, int block, int isKept);
+void foldBlock(double **rows, int block, int isKept);
+void ingestPipelined(FILE *file);
+int loadGraph(char *path);
+void saveGraph(char *path);
+void updateGraph(char *path);
+int* maxOffDiagonalValue(symMatrix *mat);
+double calcTheta(symMatrix *matrix, int i, int j);
 double calcT(double theta);
 double calcC(double t);
 double calcS(double t, double c);
-void createRotationMatrixP(double** P, int maxRow, int maxCol, double c, double s);
-void updateAPrime(double** A, double** APrime, int i, int j, double c, double s);
-double calcOffSquared(double** mat);
-int checkConvergence(double** A, double** APrime);
-void printJacobi(double **A, double **V); 
-double** jacobi(double **A, int toPrint);
+void applyRotationToV(double **V, int i, int j, double c, double s);
+void rotateRuns(double *runI, double *runJ, int count, double c, double s);
+void rotateSymMatrix(symMatrix *A, int i, int j, double c, double s);
+double calcOffSquared(symMatrix *mat);
+int checkConvergence(double a, double ap);
+void printJacobi(symMatrix *A, double **V); 
+int loadWarmBasis(char *path, double **basis, int n);
+void saveWarmBasis(char *path, double **basis, int n);
+void* checkpointWriter(void *arg);
+void writeSnapshot(void);
+void startCheckpoints(void);
+void stopCheckpoints(void);
+char* checkpointBuffer(char *suffix, size_t size, int wait);
+void commitCheckpoint(void);
+int checkpointDue(double *last);
+int saveCheckpoint(char *suffix, unsigned int *header, double **rows,
+                   int numOfRows, size_t *rowSizes, int wait);
+int loadCheckpoint(char *suffix, unsigned int *header, double **rows,
+                   int numOfRows, size_t *rowSizes);
+void rotateIntoBasis(symMatrix *A, double **basis);
+void jacobiCheckpointHeader(symMatrix *A, unsigned int *header);
+int saveJacobiCheckpoint(symMatrix *A, unsigned int *header, int count, int isDone, int wait);
+int loadJacobiCheckpoint(symMatrix *A, unsigned int *header);
+symMatrix* jacobi(symMatrix *A, int toPrint);
 int compareEigenVectors(const void *a, const void *b); 
 void sortEigenVectorsAndValues(void); 
+void hashBytes(unsigned int hash[2], void *data, size_t size);
+void hashRows(unsigned int hash[2], unsigned int *params, size_t numOfParams, int numOfRows);
+void hashVectors(unsigned int hash[2]);
+unsigned int eigenCacheReal(void);
+void eigenCachePath(char *path, unsigned int hash[2]);
+int loadEigenCache(void);
+void saveEigenCache(void);
+double* mapFile(char *path, size_t size);
+void unmapFile(double *map, size_t size);
+void nystromEigenpairs(void);
+int* chooseLandmarks(int m);
+void allocLandmarkModel(int m);
 int eigengapHeuristic(void);
-void normalizeUMatrix(void); 
+void normalizeUMatrix(double **mat, int numOfCols); 
+double** buildTMatrix(int numOfCols);
 void createUMatrix(void);
+void buildModel(spkModel *model, double **points, int numOfPoints, int dim, int numOfCols);
+void embedPoint(spkModel *model, double *point, double *row);
+void predictPoints(spkModel *model, double **points, int numOfPoints, int *labels);
+void freeModel(spkModel *model);
+void printPredictions(spkModel *model, char *path);
+int* parseKList(char *list, int *numOfKs);
+void runSweepK(sweepResult *result);
+int defaultNumOfThreads(void);
+void sweepK(sweepResult *results, int numOfKs, int numOfWorkers);
+void printSweep(sweepResult *results, int numOfKs);
+long jobCost(char *path);
+batchJob* readManifest(char *path, int *numOfJobs);
+void freeJobs(batchJob *jobs, int numOfJobs);
+int compareJobCosts(const void *a, const void *b);
+void runJob(batchJob *job, char *outPath);
+double runBatch(batchJob *jobs, int numOfJobs, int numOfWorkers, char *outDir);
+void printBatch(batchJob *jobs, int numOfJobs, double seconds);
+double profileNow(void);
+void profileStart(char *jsonPath, char *traceFilePath);
+void profileStage(const char *name, double start, long arg);
+void profileCount(const char *name, double value);
+void profileChange(int numOfChanges);
+long peakRss(void);
+void profileFinish(char *profileGoal);
 void free2DDoubleArray(double ** arr, int numOfElements);
-void free2DIntArray(int ** arr, int numOfElements);
+void freeSpectralMemory(void);
+void parseOptions(int argc, char *argv[]);
+void normalizeOptions(void);
 void freeMemory(void);
+void runGoal(void);
 
 #endif
\ No newline at end of file
@@ -97,24 +97,23 @@ def main(max_iter=300):
     numOfVectors = data.shape[0]
     dimension = data.shape[1]
     
-    initialcentroids = []
     if (goal=="spk"):
-        #Create the new T matrix and calc the new k if k==0
-        data, k = spkmeans.initiateTMatrixAndK(data.values.tolist(), k, numOfVectors, dimension)
-        data = pd.DataFrame(data)
-        numOfVectors = data.shape[0]
-        dimension = data.shape[1]
+        #Create the new T matrix inside a C session and calc the new k if k==0
+        session = spkmeans.Session(data.values.tolist(), numOfVectors, dimension)
+        k = session.embed(k)
+        
+        #View the T matrix kept in C memory without copying it
+        data = np.asarray(memoryview(session))
         
         #Initiate the centroids list
-        initialCentroidsIndices, initialcentroids = initCentroids(data.index, data.values, k, numOfVectors, dimension)
+        initialCentroidsIndices, initialcentroids = initCentroids(range(numOfVectors), data, k, numOfVectors, k)
         
-    #Transform the vectors to list of lists
-    data = data.values.tolist()
-
-    #Run the C part
-    centroids = spkmeans.fit(initialcentroids, k, max_iter, data, goal, numOfVectors, dimension)
-    if (goal=="spk"):
+        #Run the C part on the kept T matrix
+        centroids = session.fit(initialCentroidsIndices, max_iter)
         printResult(initialCentroidsIndices, centroids)
+    else:
+        #Transform the vectors to list of lists and run the C part
+        spkmeans.fit([], k, max_iter, data.values.tolist(), goal, numOfVectors, dimension)
 
 
 if __name__ == "__main__":
@@ -59,7 +59,6 @@ static PyObject* initiateTMatrixAndK(PyObject *self, PyObject *args){
 
 static PyObject* fit(PyObject *self, PyObject *args){
     int i, j;
-    int counter = 1;
     PyObject *pyCentroids;
     PyObject *pyVectors;
     PyObject *tempVec = NULL;
@@ -82,6 +81,10 @@ static PyObject* fit(PyObject *self, PyObject *args){
         }
     } 
 
+    profileStart(NULL, NULL); /*SPKMEANS_PROFILE / SPKMEANS_TRACE*/
+    if (strcmp(goal,"spk")!=0){ /*the graph goals take their matrices from the arena*/
+        reserveWorkspace(planWorkspace(goal, NULL));
+    }
     if (strcmp(goal,"spk")==0){
         centroids = (double **)calloc(k, dimension*sizeof(double));
         errorAssert(centroids != NULL,0);
@@ -95,13 +98,7 @@ static PyObject* fit(PyObject *self, PyObject *args){
             }
         } 
         
-        clusters = (int **)calloc(k, numOfVectors*sizeof(int));
-        errorAssert(clusters != NULL,0);
-        while ((counter <= max_iter) && (changes > 0)) {
-            assignVectorToCluster();
-            updateCentroidValue();
-            counter += 1;
-        }
+        runKmeans();
         
         resCentroids = PyList_New(0);
         for (i=0; i<k; i++){
@@ -112,42 +109,477 @@ static PyObject* fit(PyObject *self, PyObject *args){
             PyList_Append(resCentroids, tempCentroid);
         }
 
+        profileFinish(goal);
         freeMemory();
         return resCentroids;
     }
     else if (strcmp(goal,"wam")==0){
-        printMatrix(weightedAdjacencyMatrix(),numOfVectors,numOfVectors);
+        printSymMatrix(weightedAdjacencyMatrix());
+        profileFinish(goal);
         freeMemory();
+        releaseWorkspace();
         Py_RETURN_NONE;
     } 
     else if (strcmp(goal,"ddg")==0){
-        printMatrix(diagonalDegreeMatrix(1,1),numOfVectors,numOfVectors);
+        printDiagonalMatrix(diagonalDegreeMatrix(1),numOfVectors);
+        profileFinish(goal);
         freeMemory();
+        releaseWorkspace();
         Py_RETURN_NONE;
     } 
     else if (strcmp(goal,"lnorm")==0){
-        printMatrix(laplacianNorm(),numOfVectors,numOfVectors);
+        printSymMatrix(laplacianNorm());
+        profileFinish(goal);
         freeMemory();
+        releaseWorkspace();
         Py_RETURN_NONE;
     } 
     else if (strcmp(goal,"jacobi")==0){
-        jacobi(vectors, 1);
+        squareToSymMatrix(vectors, &lnorm, numOfVectors); /*input is symmetric*/
+        jacobi(&lnorm, 1);
+        profileFinish(goal);
         freeMemory();
+        releaseWorkspace();
         Py_RETURN_NONE;
     } 
     else{
         errorAssert(0==1,1); /*If the goal is unknown*/
+        profileFinish(goal);
         freeMemory();
         Py_RETURN_NONE;
     }
     Py_RETURN_NONE;
 }
 
+static PyObject* batch(PyObject *self, PyObject *args){
+    /*runs a list of (file, k, goal) jobs on forked workers, each job's output
+    goes to outDir/<index>.txt. Returns [[status, seconds] per job, jobs/s]*/
+    int i, numOfJobs, threads = 0;
+    double seconds;
+    char *outDir = ".", *jobPath, *jobGoal;
+    batchJob *jobs;
+    PyObject *pyJobs;
+    PyObject *resJobs = NULL;
+    PyObject *result = NULL;
+
+    if (!PyArg_ParseTuple(args,"O|zi", &pyJobs, &outDir, &threads)){
+        return NULL;
+    }
+    if (!PyList_Check(pyJobs)){
+        PyErr_SetString(PyExc_ValueError, "Expected a list of (file, k, goal) jobs");
+        return NULL;
+    }
+    numOfJobs = (int)PyList_Size(pyJobs);
+    jobs = (batchJob *)calloc(numOfJobs + 1, sizeof(batchJob));
+    errorAssert(jobs != NULL,0);
+    for (i = 0; i < numOfJobs; i++) {
+        if (!PyArg_ParseTuple(PyList_GetItem(pyJobs,i), "sis", &jobPath, &jobs[i].k, &jobGoal)){
+            free(jobs);
+            return NULL;
+        }
+        jobs[i].path = jobPath; /*borrowed from the job tuples*/
+        jobs[i].goal = jobGoal;
+        jobs[i].index = i;
+        jobs[i].cost = jobCost(jobPath);
+        jobs[i].status = 1;
+    }
+
+    seconds = runBatch(jobs, numOfJobs, threads > 0 ? threads : defaultNumOfThreads(),
+        outDir != NULL ? outDir : ".");
+
+    resJobs = PyList_New(0);
+    for (i = 0; i < numOfJobs; i++) {
+        PyList_Append(resJobs, Py_BuildValue("[id]", jobs[i].status, jobs[i].seconds));
+    }
+    free(jobs);
+    result = PyList_New(2);
+    PyList_SetItem(result,0,resJobs);
+    PyList_SetItem(result,1,PyFloat_FromDouble(seconds > 0 ? numOfJobs / seconds : 0.0));
+    return result;
+}
+
+/*Session keeps the input data, its spectral embedding (the T matrix) and the
+last centroids in C memory across calls, so only k and the initial centroid
+indices cross the Python boundary. T is exposed read-only through the buffer
+protocol (np.asarray(memoryview(session))) without copying it into lists.*/
+typedef struct {
+    PyObject_HEAD
+    double **vectors; /*input data, numOfVectors x dimension*/
+    double *T; /*normalized embedding, numOfVectors x k, row major*/
+    double **centroids; /*centroids from the last fit, k x k*/
+    spkModel model; /*out-of-sample extension of the last embedding*/
+    int numOfVectors, dimension, k, exports;
+    Py_ssize_t shape[2], strides[2];
+} SessionObject;
+
+static void freeSessionEmbedding(SessionObject *self){
+    free(self->T);
+    self->T = NULL;
+    freeModel(&self->model);
+    if (self->centroids != NULL){
+        free2DDoubleArray(self->centroids, self->k);
+        self->centroids = NULL;
+    }
+}
+
+static void Session_dealloc(SessionObject *self){
+    freeSessionEmbedding(self);
+    if (self->vectors != NULL){
+        free2DDoubleArray(self->vectors, self->numOfVectors);
+    }
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int Session_init(SessionObject *self, PyObject *args, PyObject *kwds){
+    int i,j;
+    PyObject *pyVectors;
+    PyObject *tempVec = NULL;
+
+    if (!PyArg_ParseTuple(args,"Oii", &pyVectors, &self->numOfVectors, &self->dimension)){
+        return -1;
+    }
+    if (self->vectors != NULL){
+        PyErr_SetString(PyExc_RuntimeError, "Session is already initialized");
+        return -1;
+    }
+
+    self->vectors = (double **)calloc(self->numOfVectors, sizeof(double *));
+    errorAssert(self->vectors != NULL,0);
+    for (i = 0; i < self->numOfVectors; i++) {
+        self->vectors[i] = (double *)calloc(self->dimension, sizeof(double));
+        errorAssert(self->vectors[i] != NULL,0);
+        tempVec = PyList_GetItem(pyVectors,i);
+        for (j = 0; j < self->dimension; j++) {
+            self->vectors[i][j] = PyFloat_AsDouble(PyList_GetItem(tempVec,j));
+        }
+    }
+    return 0;
+}
+
+static PyObject* Session_embed(SessionObject *self, PyObject *args){
+    /*runs the spectral stage once and keeps T in the session, returns k*/
+    int i, j, calcK;
+    char *sessionCacheDir = NULL, *sessionScratchDir = NULL;
+    int landmarks = 0;
+
+    if (!PyArg_ParseTuple(args,"i|ziz", &k, &sessionCacheDir, &landmarks, &sessionScratchDir)){
+        return NULL;
+    }
+    if (self->exports > 0){
+        PyErr_SetString(PyExc_BufferError, "Session embedding is still exported");
+        return NULL;
+    }
+    freeSessionEmbedding(self);
+    profileStart(NULL, NULL);
+
+    vectors = self->vectors;
+    numOfVectors = self->numOfVectors;
+    dimension = self->dimension;
+
+    cacheDir = sessionCacheDir; /*opt-in eigen cache directory*/
+    numOfLandmarks = landmarks; /*0 for the exact path, else Nystrom*/
+    scratchDir = sessionScratchDir; /*opt-in file backing of n x n buffers*/
+    reserveWorkspace(planWorkspace("spk", NULL));
+    calcK = eigengapHeuristic();
+    cacheDir = NULL;
+    numOfLandmarks = 0;
+    scratchDir = NULL;
+    if (k==0) {
+        k = calcK;
+    }
+    createUMatrix();
+    buildModel(&self->model, self->vectors, numOfVectors, dimension, k);
+
+    self->k = k;
+    self->T = (double *)calloc(numOfVectors, k*sizeof(double));
+    errorAssert(self->T != NULL,0);
+    for (i = 0; i < numOfVectors; i++) {
+        for (j = 0; j < k; j++) {
+            self->T[i*k+j] = U[i][j];
+        }
+    }
+    self->shape[0] = numOfVectors;
+    self->shape[1] = k;
+    self->strides[0] = k*sizeof(double);
+    self->strides[1] = sizeof(double);
+
+    free2DDoubleArray(U, numOfVectors);
+    freeSpectralMemory();
+    releaseWorkspace();
+    U = NULL;
+    vectors = NULL;
+
+    profileFinish("embed");
+    return Py_BuildValue("i",k);
+}
+
+static PyObject* Session_fit(SessionObject *self, PyObject *args){
+    /*runs kmeans on the kept embedding from the given initial centroid indices*/
+    int i, j, ind;
+    PyObject *pyIndices;
+    PyObject *tempCentroid = NULL;
+    PyObject *resCentroids = NULL;
+
+    if (!PyArg_ParseTuple(args,"Oi", &pyIndices, &max_iter)){
+        return NULL;
+    }
+    if (self->T == NULL){
+        PyErr_SetString(PyExc_RuntimeError, "Session.embed must be called before fit");
+        return NULL;
+    }
+    if (!PyList_Check(pyIndices) || PyList_Size(pyIndices) != self->k){
+        PyErr_SetString(PyExc_ValueError, "Expected a list of k centroid indices");
+        return NULL;
+    }
+    for (i = 0; i < self->k; i++) { /*before anything is freed or allocated*/
+        ind = (int)PyLong_AsLong(PyList_GetItem(pyIndices,i));
+        if (ind == -1 && PyErr_Occurred()){
+            return NULL;
+        }
+        if (ind < 0 || ind >= self->numOfVectors){
+            PyErr_SetString(PyExc_ValueError, "Centroid indices must be in range(n)");
+            return NULL;
+        }
+    }
+
+    profileStart(NULL, NULL);
+    numOfVectors = self->numOfVectors;
+    dimension = k = self->k;
+    vectors = (double **)calloc(numOfVectors, sizeof(double *));
+    errorAssert(vectors != NULL,0);
+    for (i = 0; i < numOfVectors; i++) {
+        vectors[i] = self->T + i*k; /*rows point into T, no copy*/
+    }
+
+    if (self->centroids != NULL){
+        free2DDoubleArray(self->centroids, k);
+    }
+    centroids = (double **)calloc(k, sizeof(double *));
+    errorAssert(centroids != NULL,0);
+    for (i = 0; i < k; i++) {
+        ind = (int)PyLong_AsLong(PyList_GetItem(pyIndices,i));
+        centroids[i] = (double *)calloc(dimension, sizeof(double));
+        errorAssert(centroids[i] != NULL,0);
+        for (j = 0; j < dimension; j++) {
+            centroids[i][j] = vectors[ind][j];
+        }
+    }
+
+    runKmeans();
+
+    resCentroids = PyList_New(0);
+    for (i=0; i<k; i++){
+        tempCentroid = PyList_New(0);
+        for (j=0; j<dimension; j++){
+            PyList_Append(tempCentroid,PyFloat_FromDouble(centroids[i][j]));
+        }
+        PyList_Append(resCentroids, tempCentroid);
+    }
+
+    self->centroids = centroids;
+    free(vectors);
+    centroids = NULL;
+    vectors = NULL;
+
+    profileFinish("fit");
+    return resCentroids;
+}
+
+static PyObject* Session_predict(SessionObject *self, PyObject *args){
+    /*labels new points with the last fit's centroids, without re-embedding*/
+    int i, j, numOfPoints, *labels;
+    double **points;
+    PyObject *pyPoints;
+    PyObject *tempVec = NULL;
+    PyObject *resLabels = NULL;
+
+    if (!PyArg_ParseTuple(args,"O", &pyPoints)){
+        return NULL;
+    }
+    if (self->centroids == NULL){
+        PyErr_SetString(PyExc_RuntimeError, "Session.fit must be called before predict");
+        return NULL;
+    }
+    if (!PyList_Check(pyPoints)){
+        PyErr_SetString(PyExc_ValueError, "Expected a list of points");
+        return NULL;
+    }
+    numOfPoints = (int)PyList_Size(pyPoints);
+    if (numOfPoints <= 0){
+        return PyList_New(0);
+    }
+    for (i = 0; i < numOfPoints; i++) {
+        tempVec = PyList_GetItem(pyPoints,i);
+        if (!PyList_Check(tempVec) || PyList_Size(tempVec) != self->dimension){
+            PyErr_SetString(PyExc_ValueError, "Points must have the session's dimension");
+            return NULL;
+        }
+    }
+
+    points = (double **)calloc(numOfPoints, sizeof(double *));
+    errorAssert(points != NULL,0);
+    for (i = 0; i < numOfPoints; i++) {
+        points[i] = (double *)calloc(self->dimension, sizeof(double));
+        errorAssert(points[i] != NULL,0);
+        tempVec = PyList_GetItem(pyPoints,i);
+        for (j = 0; j < self->dimension; j++) {
+            points[i][j] = PyFloat_AsDouble(PyList_GetItem(tempVec,j));
+        }
+    }
+    labels = (int *)calloc(numOfPoints, sizeof(int));
+    errorAssert(labels != NULL,0);
+
+    self->model.centroids = self->centroids;
+    predictPoints(&self->model, points, numOfPoints, labels);
+
+    resLabels = PyList_New(0);
+    for (i = 0; i < numOfPoints; i++) {
+        PyList_Append(resLabels, PyLong_FromLong(labels[i]));
+    }
+    free(labels);
+    free2DDoubleArray(points, numOfPoints);
+    return resLabels;
+}
+
+static PyObject* Session_sweep(SessionObject *self, PyObject *args){
+    /*computes the eigenpairs once and runs kmeans for every k in ks,
+    returns (eigengaps, [(k, inertia, iterations, centroids), ...])*/
+    int i, j, c, limit, numOfKs, threads = 0;
+    PyObject *pyKs, *pyGaps, *pyResults, *tempCentroid, *resCentroids;
+    sweepResult *results;
+
+    if (!PyArg_ParseTuple(args,"Oi|i", &pyKs, &max_iter, &threads)){
+        return NULL;
+    }
+    if (!PyList_Check(pyKs) || PyList_Size(pyKs) == 0){
+        PyErr_SetString(PyExc_ValueError, "Expected a non-empty list of k values");
+        return NULL;
+    }
+    numOfKs = (int)PyList_Size(pyKs);
+    results = (sweepResult *)calloc(numOfKs, sizeof(sweepResult));
+    errorAssert(results != NULL,0);
+    for (i = 0; i < numOfKs; i++) {
+        results[i].k = (int)PyLong_AsLong(PyList_GetItem(pyKs,i));
+        if (results[i].k == -1 && PyErr_Occurred()){
+            free(results);
+            return NULL;
+        }
+        if (results[i].k <= 0 || results[i].k >= self->numOfVectors){
+            free(results);
+            PyErr_SetString(PyExc_ValueError, "k values must be in range(1, n)");
+            return NULL;
+        }
+    }
+
+    vectors = self->vectors;
+    numOfVectors = self->numOfVectors;
+    dimension = self->dimension;
+    profileStart(NULL, NULL);
+    reserveWorkspace(planWorkspace("spk", NULL));
+    eigengapHeuristic();
+    sweepK(results, numOfKs, threads > 0 ? threads : defaultNumOfThreads());
+
+    limit = numOfEigenVals / 2;
+    pyGaps = PyList_New(0);
+    for (i = 0; i < limit; i++) {
+        PyList_Append(pyGaps, PyFloat_FromDouble(eigenGaps[i]));
+    }
+    pyResults = PyList_New(0);
+    for (i = 0; i < numOfKs; i++) {
+        resCentroids = PyList_New(0);
+        for (j = 0; j < results[i].k; j++) {
+            tempCentroid = PyList_New(0);
+            for (c = 0; c < results[i].k; c++) {
+                PyList_Append(tempCentroid, PyFloat_FromDouble(results[i].centroids[j][c]));
+            }
+            PyList_Append(resCentroids, tempCentroid);
+        }
+        PyList_Append(pyResults, Py_BuildValue("idiN", results[i].k,
+            results[i].inertia, results[i].iterations, resCentroids));
+        free2DDoubleArray(results[i].centroids, results[i].k);
+    }
+
+    free(results);
+    profileFinish("sweep");
+    freeSpectralMemory();
+    releaseWorkspace();
+    vectors = NULL;
+    return Py_BuildValue("NN", pyGaps, pyResults);
+}
+
+static int Session_getbuffer(SessionObject *self, Py_buffer *view, int flags){
+    if (self->T == NULL){
+        PyErr_SetString(PyExc_BufferError, "Session has no embedding yet");
+        view->obj = NULL;
+        return -1;
+    }
+    view->buf = self->T;
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+    view->len = self->shape[0]*self->strides[0];
+    view->readonly = 1;
+    view->itemsize = sizeof(double);
+    view->format = (flags & PyBUF_FORMAT) ? "d" : NULL;
+    view->ndim = 2;
+    view->shape = self->shape;
+    view->strides = self->strides;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    self->exports++;
+    return 0;
+}
+
+static void Session_releasebuffer(SessionObject *self, Py_buffer *view){
+    self->exports--;
+}
+
+static PyBufferProcs sessionBufferProcs = {
+    (getbufferproc) Session_getbuffer,
+    (releasebufferproc) Session_releasebuffer
+};
+
+static PyMethodDef sessionMethods[] = {
+    {"embed",
+    (PyCFunction) Session_embed,
+    METH_VARARGS,
+    PyDoc_STR("Computes and keeps the T matrix, returns k. embed(k, cacheDir=None, landmarks=0, scratchDir=None)")},
+    {"fit",
+    (PyCFunction) Session_fit,
+    METH_VARARGS,
+    PyDoc_STR("Kmeans on the kept T matrix from initial centroid indices")},
+    {"predict",
+    (PyCFunction) Session_predict,
+    METH_VARARGS,
+    PyDoc_STR("Labels new points with the last fit's centroids. predict(points)")},
+    {"sweep",
+    (PyCFunction) Session_sweep,
+    METH_VARARGS,
+    PyDoc_STR("Kmeans for every k in a list over one eigendecomposition. sweep(ks, max_iter, threads=0)")},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyTypeObject SessionType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "spkmeans.Session",
+    .tp_basicsize = sizeof(SessionObject),
+    .tp_dealloc = (destructor) Session_dealloc,
+    .tp_as_buffer = &sessionBufferProcs,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = PyDoc_STR("Keeps data, T matrix and centroids in C memory between calls"),
+    .tp_methods = sessionMethods,
+    .tp_init = (initproc) Session_init,
+    .tp_new = PyType_GenericNew,
+};
+
 static PyMethodDef kmeansMethods[] = {
     {"fit",
     (PyCFunction) fit,
     METH_VARARGS,
     PyDoc_STR("Kmeans")},
+    {"batch",
+    (PyCFunction) batch,
+    METH_VARARGS,
+    PyDoc_STR("Runs (file, k, goal) jobs on a worker pool. batch(jobs, outDir='.', threads=0)")},
     {"initiateTMatrixAndK",
     (PyCFunction) initiateTMatrixAndK,
     METH_VARARGS,
@@ -167,9 +599,18 @@ PyMODINIT_FUNC
 PyInit_spkmeans(void)
 {
     PyObject *m;
+    if (PyType_Ready(&SessionType) < 0) {
+        return NULL;
+    }
     m = PyModule_Create(&moduledef);
     if (!m) {
         return NULL;
     }
+    Py_INCREF(&SessionType);
+    if (PyModule_AddObject(m, "Session", (PyObject *)&SessionType) < 0) {
+        Py_DECREF(&SessionType);
+        Py_DECREF(m);
+        return NULL;
+    }
     return m;
 }
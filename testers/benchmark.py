@@ -0,0 +1,217 @@
+import argparse
+import csv
+import ctypes
+import filecmp
+import json
+import math
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), ".."))
+
+# Times every goal through the CLI and the Python module on deterministic
+# Gaussian blobs and writes one CSV row per (interface, goal, n, d, clusters).
+#
+#   python testers/benchmark.py run --binary ./spkmeans --out base.csv
+#   python testers/benchmark.py run --binary ./spkmeans --out new.csv
+#   python testers/benchmark.py compare base.csv new.csv
+#
+# compare exits with 1 when a goal got slower than the threshold, so it can
+# gate a build. Peak RSS and the stage split come from the --profile report.
+# Every module run of a printing goal is also checked against the CLI's
+# output on the same input, so a timing never comes from a wrong result.
+
+GOALS = ["wam", "ddg", "lnorm", "jacobi", "spk"]
+FIELDS = ["interface", "goal", "n", "d", "clusters", "k", "repeats", "median_s", "min_s",
+          "points_per_s", "peak_rss_kb", "jacobi_s", "kmeans_s"]
+KEY = ["interface", "goal", "n", "d", "clusters"]
+
+
+def blobs(n, d, clusters, seed):
+    # same n, d, clusters and seed always give the same file
+    rng = np.random.default_rng([seed, n, d, clusters])
+    centers = rng.uniform(-10, 10, size=(clusters, d))
+    labels = np.arange(n) % clusters
+    return centers[labels] + rng.normal(0, 1, size=(n, d))
+
+
+def write_csv(path, matrix):
+    np.savetxt(path, matrix, fmt="%.4f", delimiter=",")
+
+
+def stage_seconds(report, name):
+    return sum(stage["duration_us"] for stage in report["stages"] if stage["name"] == name) / 1e6
+
+
+def time_cli(binary, goal, k, path, repeats, workdir):
+    times, report = [], None
+    profile = os.path.join(workdir, "profile.json")
+    for _ in range(repeats):
+        start = time.perf_counter()
+        subprocess.run([binary, str(k), goal, path, f"--profile={profile}"],
+                       stdout=subprocess.DEVNULL, check=True)
+        times.append(time.perf_counter() - start)
+        with open(profile) as f:
+            report = json.load(f)
+    return times, report
+
+
+def cli_output(binary, goal, k, path, workdir):
+    # what the CLI prints, the reference for the module's output
+    output = os.path.join(workdir, f"cli_{goal}.txt")
+    with open(output, "w") as f:
+        subprocess.run([binary, str(k), goal, path], stdout=f, check=True)
+    return output
+
+
+def time_module(goal, k, matrix, repeats, workdir, expected=None):
+    import spkmeans
+    libc = ctypes.CDLL(None)  # C stdio buffers the module's prints
+    times, report = [], None
+    profile = os.path.join(workdir, "profile.json")
+    output = os.path.join(workdir, f"module_{goal}.txt")
+    os.environ["SPKMEANS_PROFILE"] = profile
+    vectors = matrix.tolist()
+    n, d = matrix.shape
+    saved = os.dup(1)
+    try:
+        for repeat in range(repeats):
+            sys.stdout.flush()
+            target = os.open(output, os.O_WRONLY | os.O_CREAT | os.O_TRUNC)
+            os.dup2(target, 1)  # the graph goals print from C
+            os.close(target)
+            start = time.perf_counter()
+            if goal == "spk":
+                session = spkmeans.Session(vectors, n, d)
+                k_used = session.embed(k)
+                session.fit(list(range(k_used)), 300)
+            else:
+                spkmeans.fit([], k, 300, vectors, goal, n, d)
+            times.append(time.perf_counter() - start)
+            libc.fflush(None)
+            os.dup2(saved, 1)
+            with open(profile) as f:
+                report = json.load(f)
+            if expected is not None and not filecmp.cmp(output, expected, shallow=False):
+                raise SystemExit(f"module {goal} on n={n}, d={d} differs from the CLI in repeat {repeat + 1}")
+    finally:
+        libc.fflush(None)
+        os.dup2(saved, 1)
+        os.close(saved)
+        del os.environ["SPKMEANS_PROFILE"]
+    return times, report
+
+
+def run(args):
+    sizes = [int(value) for value in args.sizes.split(",")]
+    dims = [int(value) for value in args.dims.split(",")]
+    clusters_list = [int(value) for value in args.clusters.split(",")]
+    goals = args.goals.split(",")
+    interfaces = args.interfaces.split(",")
+    rows = []
+    with tempfile.TemporaryDirectory() as workdir:
+        for n in sizes:
+            for d in dims:
+                for clusters in clusters_list:
+                    data_path = os.path.join(workdir, "data.csv")
+                    write_csv(data_path, blobs(n, d, clusters, args.seed))
+                    data = np.loadtxt(data_path, delimiter=",", ndmin=2)  # the rounded input the CLI reads
+                    lnorm_path = os.path.join(workdir, "lnorm.csv")
+                    with open(lnorm_path, "w") as f:  # jacobi runs on the lnorm of the blobs
+                        subprocess.run([args.binary, "0", "lnorm", data_path], stdout=f, check=True)
+                    lnorm = np.loadtxt(lnorm_path, delimiter=",", ndmin=2)
+                    for interface in interfaces:
+                        for goal in goals:
+                            path, matrix = (lnorm_path, lnorm) if goal == "jacobi" else (data_path, data)
+                            k = clusters if goal == "spk" else 0
+                            if interface == "cli":
+                                times, report = time_cli(args.binary, goal, k, path, args.repeat, workdir)
+                            else:
+                                expected = None if goal == "spk" else cli_output(args.binary, goal, k, path, workdir)
+                                times, report = time_module(goal, k, matrix, args.repeat, workdir, expected)
+                            median = statistics.median(times)
+                            rows.append({
+                                "interface": interface, "goal": goal, "n": n, "d": d,
+                                "clusters": clusters, "k": k, "repeats": args.repeat,
+                                "median_s": f"{median:.6f}", "min_s": f"{min(times):.6f}",
+                                "points_per_s": f"{n / median:.1f}",
+                                "peak_rss_kb": report["peak_rss_kb"],
+                                "jacobi_s": f"{stage_seconds(report, 'jacobi'):.6f}",
+                                "kmeans_s": f"{stage_seconds(report, 'kmeans'):.6f}"})
+                            print(",".join(str(rows[-1][field]) for field in FIELDS), file=sys.stderr)
+    with open(args.out, "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=FIELDS)
+        writer.writeheader()
+        writer.writerows(rows)
+    print_scaling(rows)
+
+
+def print_scaling(rows):
+    # log-log slope of time over n, e.g. about 2 for the O(n^2) graph goals
+    curves = {}
+    for row in rows:
+        key = (row["interface"], row["goal"], row["d"], row["clusters"])
+        curves.setdefault(key, []).append((int(row["n"]), float(row["median_s"])))
+    print("interface,goal,d,clusters,scaling_exponent")
+    for key, points in sorted(curves.items()):
+        points = [(n, t) for n, t in sorted(points) if t > 0]
+        if len(points) < 2:
+            continue
+        slope = np.polyfit([math.log(n) for n, _ in points], [math.log(t) for _, t in points], 1)[0]
+        print(f"{key[0]},{key[1]},{key[2]},{key[3]},{slope:.2f}")
+
+
+def read_rows(path):
+    with open(path) as f:
+        return {tuple(row[field] for field in KEY): row for row in csv.DictReader(f)}
+
+
+def compare(args):
+    base, new = read_rows(args.base), read_rows(args.new)
+    regressions = 0
+    print("interface,goal,n,d,clusters,base_s,new_s,ratio,status")
+    for key in sorted(base, key=lambda key: (key[0], key[1], int(key[2]), int(key[3]), int(key[4]))):
+        if key not in new:
+            continue
+        base_s, new_s = float(base[key]["median_s"]), float(new[key]["median_s"])
+        ratio = new_s / base_s if base_s > 0 else 1.0
+        # tiny runs are dominated by process start, only flag measurable ones
+        status = "ok"
+        if ratio > 1 + args.threshold and new_s - base_s > args.min_seconds:
+            status = "REGRESSION"
+            regressions += 1
+        elif ratio < 1 - args.threshold:
+            status = "faster"
+        print(f"{','.join(key)},{base_s:.6f},{new_s:.6f},{ratio:.3f},{status}")
+    print(f"{regressions} regression(s)", file=sys.stderr)
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="spkmeans benchmark suite")
+    commands = parser.add_subparsers(dest="command", required=True)
+    run_parser = commands.add_parser("run")
+    run_parser.add_argument("--binary", default="./spkmeans")
+    run_parser.add_argument("--out", default="benchmark.csv")
+    run_parser.add_argument("--sizes", default="100,200,400")
+    run_parser.add_argument("--dims", default="2,8")
+    run_parser.add_argument("--clusters", default="3,6")
+    run_parser.add_argument("--goals", default=",".join(GOALS))
+    run_parser.add_argument("--interfaces", default="cli,module")
+    run_parser.add_argument("--repeat", type=int, default=3)
+    run_parser.add_argument("--seed", type=int, default=0)
+    compare_parser = commands.add_parser("compare")
+    compare_parser.add_argument("base")
+    compare_parser.add_argument("new")
+    compare_parser.add_argument("--threshold", type=float, default=0.10)
+    compare_parser.add_argument("--min-seconds", type=float, default=0.005)
+    args = parser.parse_args()
+    if args.command == "run":
+        run(args)
+    else:
+        sys.exit(compare(args))
@@ -0,0 +1,73 @@
+import argparse
+import json
+import os
+import subprocess
+import tempfile
+import numpy as np
+
+# Compares spk on weighted representatives (--coreset=ratio) with the full
+# run on the same input, one row per ratio:
+#
+#   python testers/coreset_quality.py --binary ./spkmeans --k 4 data.csv
+#
+# Labels of every input point come from --labels; quality is the adjusted
+# Rand index and the share of points with the same cluster as the full run
+# (after matching the cluster numbers). The default jacobi cap leaves large
+# full runs far from converged, so compare with a higher --rotations.
+
+
+def run(binary, k, path, rotations, workdir, ratio=None):
+    profile = os.path.join(workdir, "profile.json")
+    command = [binary, str(k), "spk", path, "--labels", f"--rotations={rotations}", f"--profile={profile}"]
+    if ratio is not None:
+        command.append(f"--coreset={ratio}")
+    output = subprocess.run(command, capture_output=True, text=True, check=True).stdout
+    labels = np.array([int(label) for label in output.strip().split("\n")[-1].split(",")])
+    with open(profile) as f:
+        report = json.load(f)
+    return labels, report["total_us"] / 1e6, report["peak_rss_kb"], report["counters"]
+
+
+def adjusted_rand(a, b):
+    table = np.zeros((a.max() + 1, b.max() + 1))
+    np.add.at(table, (a, b), 1)
+    pairs = lambda x: (x * (x - 1) / 2).sum()
+    index, rows, cols, total = pairs(table), pairs(table.sum(1)), pairs(table.sum(0)), pairs(np.array([len(a)]))
+    expected = rows * cols / total if total else 0
+    best = (rows + cols) / 2
+    return 1.0 if best == expected else (index - expected) / (best - expected)
+
+
+def agreement(a, b):
+    # greedy one to one matching of the clusters by overlap
+    table = np.zeros((a.max() + 1, b.max() + 1))
+    np.add.at(table, (a, b), 1)
+    matched = 0
+    while table.size and table.max() > 0:
+        i, j = np.unravel_index(table.argmax(), table.shape)
+        matched += table[i, j]
+        table[i, :] = table[:, j] = 0
+    return matched / len(a)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="coreset spk vs the full run")
+    parser.add_argument("path")
+    parser.add_argument("--binary", default="./spkmeans")
+    parser.add_argument("--k", type=int, default=0)
+    parser.add_argument("--ratios", default="0.5,0.2,0.1,0.05")
+    parser.add_argument("--rotations", type=int, default=100)
+    args = parser.parse_args()
+    with tempfile.TemporaryDirectory() as workdir:
+        full, seconds, rss, _ = run(args.binary, args.k, args.path, args.rotations, workdir)
+        print("ratio,representatives,k,seconds,speedup,peak_rss_kb,ari,agreement")
+        print(f"1,{len(full)},{full.max() + 1},{seconds:.6f},1.00,{rss},1.0000,1.0000")
+        for ratio in args.ratios.split(","):
+            labels, reduced, rss, counters = run(args.binary, args.k, args.path, args.rotations, workdir, ratio)
+            print(f"{ratio},{counters['coreset_size']},{counters['k']},{reduced:.6f},"
+                  f"{seconds / reduced:.2f},{rss},{adjusted_rand(full, labels):.4f},"
+                  f"{agreement(full, labels):.4f}")
+
+
+if __name__ == "__main__":
+    main()
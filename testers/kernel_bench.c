@@ -0,0 +1,234 @@
+/*Times the generic distance loops against the kernels unrolled for each
+dim, on the same points, and checks that both give the same sums:
+
+    gcc -O2 testers/kernel_bench.c -lm -o kernel_bench && ./kernel_bench
+
+prints one csv row per (kernel, d), d past KERNEL_MAX_DIM runs the generic
+loop both ways. Then times the kmeans assignment of unit rows in dim k (as
+after the embedding) with nearestRealCentroid per point against
+assignBlocked, and checks that both give the same labels. Last, rotations
+per second for n = 1k..8k: rotateSymMatrix against the earlier update of a
+separate A' (copied back after every rotation), with a check that both
+leave the same matrix, and the whole jacobi loop, which also scans the
+matrix for the largest entry and the off norm every rotation*/
+#define main spkmeansMain
+#include "../spkmeans.c"
+#undef main
+
+#define BENCH_POINTS 512
+#define BENCH_MAX_DIM 10
+#define BENCH_CALLS 20000000L
+#define BENCH_ASSIGN_POINTS 4096
+#define BENCH_ASSIGN_WORK 400000000L /*point x centroid x dim per timing*/
+#define BENCH_ROTATE_WORK 400000000L /*rotations x n per timing*/
+#define BENCH_JACOBI_ROTATIONS 8
+
+double benchPoints[BENCH_POINTS*BENCH_MAX_DIM];
+spkReal benchRealPoints[BENCH_POINTS*BENCH_MAX_DIM];
+
+double timeKernel(distanceKernel kernel, int dim, double *sum) {
+    /*ns per call over BENCH_CALLS calls on consecutive pairs of points*/
+    long call;
+    int i = 0, j = 1;
+    clock_t start = clock();
+    *sum = 0;
+    for (call = 0; call < BENCH_CALLS; call++) {
+        *sum += kernel(benchPoints + i*dim, benchPoints + j*dim, dim);
+        i = j;
+        j = j + 1 < BENCH_POINTS ? j + 1 : 0;
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / BENCH_CALLS;
+}
+
+double timeRealKernel(realDistanceKernel kernel, int dim, double *sum) {
+    /*timeKernel for the spkReal kernels*/
+    long call;
+    int i = 0, j = 1;
+    clock_t start = clock();
+    *sum = 0;
+    for (call = 0; call < BENCH_CALLS; call++) {
+        *sum += kernel(benchRealPoints + i*dim, benchRealPoints + j*dim, dim);
+        i = j;
+        j = j + 1 < BENCH_POINTS ? j + 1 : 0;
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / BENCH_CALLS;
+}
+
+void printRow(const char *name, int dim, double generic, double specialized, int isSame) {
+    printf("%s,%d,%.2f,%.2f,%.2f,%s\n", name, dim, generic, specialized,
+        generic / specialized, isSame ? "same" : "DIFFERENT");
+}
+
+void benchAssign(int numOfCents) {
+    /*one row of the assignment benchmark, points are unit rows in dim
+    numOfCents and the centroids are the first numOfCents of them*/
+    int i, j, rep, reps, isSame = 1, *labels;
+    unsigned long seed = 7;
+    double norm, scalar, blocked, **points;
+    clock_t start;
+    kmeansState state;
+
+    points = (double **)calloc(BENCH_ASSIGN_POINTS, sizeof(double *));
+    labels = (int *)calloc(BENCH_ASSIGN_POINTS, sizeof(int));
+    for (i = 0; i < BENCH_ASSIGN_POINTS; i++) {
+        points[i] = (double *)calloc(numOfCents, sizeof(double));
+        for (j = 0, norm = 0; j < numOfCents; j++) {
+            seed = (seed*1103515245ul + 12345ul) & 0x7ffffffful;
+            points[i][j] = (double)seed / 0x7fffffff - 0.5;
+            norm += points[i][j]*points[i][j];
+        }
+        for (j = 0; j < numOfCents; j++) {
+            points[i][j] /= sqrt(norm);
+        }
+    }
+    initKmeansState(&state, points, BENCH_ASSIGN_POINTS, numOfCents, points, numOfCents);
+    reps = (int)(BENCH_ASSIGN_WORK / ((long)BENCH_ASSIGN_POINTS*numOfCents*numOfCents)) + 1;
+
+    start = clock();
+    for (rep = 0; rep < reps; rep++) {
+        for (i = 0; i < BENCH_ASSIGN_POINTS; i++) {
+            labels[i] = nearestRealCentroid(state.realPoints + (size_t)i*numOfCents,
+                state.realCentroids, numOfCents, numOfCents);
+        }
+    }
+    scalar = (double)(clock() - start) / CLOCKS_PER_SEC * 1e3 / reps;
+    start = clock();
+    for (rep = 0; rep < reps; rep++) {
+        assignBlocked(&state);
+    }
+    blocked = (double)(clock() - start) / CLOCKS_PER_SEC * 1e3 / reps;
+    for (i = 0; i < BENCH_ASSIGN_POINTS; i++) {
+        isSame = isSame && labels[i] == state.labels[i];
+    }
+    printf("assign,%d,%.3f,%.3f,%.2f,%s\n", numOfCents, scalar, blocked,
+        scalar / blocked, isSame ? "same" : "DIFFERENT");
+    freeKmeansState(&state);
+    free2DDoubleArray(points, BENCH_ASSIGN_POINTS);
+    free(labels);
+}
+
+void rotateReference(symMatrix *A, symMatrix *APrime, int i, int j, double c, double s) {
+    /*the rotation as jacobi applied it before rotateSymMatrix: A' from A
+    with a branch per r, then rows and columns i and j copied back to A*/
+    int r;
+    double ari, arj;
+    for (r = 0; r < A->n; r++) {
+        if ((r!=i) && (r!=j)) {
+            ari = SYM_ENTRY(A, r, i);
+            arj = SYM_ENTRY(A, r, j);
+            if (r < i) {
+                APrime->rows[i][r] = c*ari-s*arj;
+            }
+            else {
+                APrime->rows[r][i] = c*ari-s*arj;
+            }
+            if (r < j) {
+                APrime->rows[j][r] = c*arj+s*ari;
+            }
+            else {
+                APrime->rows[r][j] = c*arj+s*ari;
+            }
+        }
+    }
+    APrime->rows[i][i] = pow(c,2)*A->rows[i][i]+pow(s,2)*A->rows[j][j]-2*s*c*SYM_ENTRY(A, i, j);
+    APrime->rows[j][j] = pow(s,2)*A->rows[i][i]+pow(c,2)*A->rows[j][j]+2*s*c*SYM_ENTRY(A, i, j);
+    APrime->rows[j][i] = 0;
+    for (r = 0; r < A->n; r++) {
+        if (r <= i) {
+            A->rows[i][r] = APrime->rows[i][r];
+        }
+        else {
+            A->rows[r][i] = APrime->rows[r][i];
+        }
+        if (r <= j) {
+            A->rows[j][r] = APrime->rows[j][r];
+        }
+        else {
+            A->rows[r][j] = APrime->rows[r][j];
+        }
+    }
+}
+
+void benchRotate(int n) {
+    /*one row of the rotation benchmark on a random symmetric n x n matrix*/
+    int rotation, rotations, i, *pairs;
+    size_t e, size = (size_t)n*(n+1)/2;
+    unsigned long seed = 11;
+    double reference, kernel, whole, c = cos(0.3), s = sin(0.3);
+    clock_t start;
+    symMatrix A, B, APrime;
+
+    allocSymMatrix(&A, n);
+    allocSymMatrix(&B, n);
+    allocSymMatrix(&APrime, n);
+    for (e = 0; e < size; e++) {
+        seed = (seed*1103515245ul + 12345ul) & 0x7ffffffful;
+        A.data[e] = B.data[e] = APrime.data[e] = (double)seed / 0x7fffffff - 0.5;
+    }
+    rotations = (int)(BENCH_ROTATE_WORK / n);
+    pairs = (int *)calloc(2*rotations, sizeof(int));
+    for (rotation = 0; rotation < rotations; rotation++) {
+        seed = (seed*1103515245ul + 12345ul) & 0x7ffffffful;
+        i = (int)(seed % (n - 1));
+        seed = (seed*1103515245ul + 12345ul) & 0x7ffffffful;
+        pairs[2*rotation] = i;
+        pairs[2*rotation+1] = i + 1 + (int)(seed % (n - 1 - i));
+    }
+    start = clock();
+    for (rotation = 0; rotation < rotations; rotation++) {
+        rotateReference(&A, &APrime, pairs[2*rotation], pairs[2*rotation+1], c, s);
+    }
+    reference = rotations / ((double)(clock() - start) / CLOCKS_PER_SEC);
+    start = clock();
+    for (rotation = 0; rotation < rotations; rotation++) {
+        rotateSymMatrix(&B, pairs[2*rotation], pairs[2*rotation+1], c, s);
+    }
+    kernel = rotations / ((double)(clock() - start) / CLOCKS_PER_SEC);
+    for (e = 0; e < size && A.data[e] == B.data[e]; e++);
+    freeSymMatrix(&APrime);
+    freeSymMatrix(&B);
+    free(pairs);
+
+    numOfVectors = n;
+    maxRotations = BENCH_JACOBI_ROTATIONS;
+    start = clock();
+    jacobi(&A, 0);
+    whole = BENCH_JACOBI_ROTATIONS / ((double)(clock() - start) / CLOCKS_PER_SEC);
+    freeDenseMatrix(V);
+    freeSymMatrix(&A);
+    printf("rotate,%d,%.0f,%.0f,%.2f,%.1f,%s\n", n, reference, kernel, kernel / reference,
+        whole, e == size ? "same" : "DIFFERENT");
+}
+
+int main() {
+    int i, dim;
+    unsigned long seed = 1;
+    double generic, specialized, genericSum, specializedSum;
+
+    for (i = 0; i < BENCH_POINTS*BENCH_MAX_DIM; i++) {
+        seed = (seed*1103515245ul + 12345ul) & 0x7ffffffful; /*same points on every run*/
+        benchPoints[i] = (double)seed / 0x7fffffff * 20 - 10;
+        benchRealPoints[i] = (spkReal)benchPoints[i];
+    }
+    printf("kernel,d,generic_ns,specialized_ns,speedup,sums\n");
+    for (dim = 1; dim <= BENCH_MAX_DIM; dim++) {
+        generic = timeKernel(affinityKernels[0], dim, &genericSum);
+        specialized = timeKernel(DISTANCE_KERNEL(affinityKernels, dim), dim, &specializedSum);
+        printRow("affinity", dim, generic, specialized, genericSum == specializedSum);
+        generic = timeKernel(vectorKernels[0], dim, &genericSum);
+        specialized = timeKernel(DISTANCE_KERNEL(vectorKernels, dim), dim, &specializedSum);
+        printRow("vector", dim, generic, specialized, genericSum == specializedSum);
+        generic = timeRealKernel(realKernels[0], dim, &genericSum);
+        specialized = timeRealKernel(DISTANCE_KERNEL(realKernels, dim), dim, &specializedSum);
+        printRow("real", dim, generic, specialized, genericSum == specializedSum);
+    }
+    printf("assign,k,scalar_ms,blocked_ms,speedup,labels\n");
+    for (dim = 4; dim <= 128; dim *= 2) {
+        benchAssign(dim);
+    }
+    printf("rotate,n,reference_per_s,kernel_per_s,speedup,jacobi_per_s,matrix\n");
+    for (dim = 1024; dim <= 8192; dim *= 2) {
+        benchRotate(dim);
+    }
+    return 0;
+}
@@ -0,0 +1,71 @@
+import os
+import sys
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), ".."))
+import spkmeans
+
+# Compares the Nystrom path (--landmarks) with the exact spectral embedding
+# on the tester files. The reference is a fully converged numpy
+# eigendecomposition of lnorm, since the C exact path stops after 100 rotations.
+# Labels are compared at the exact eigengap k, a smaller k would cut through
+# a repeated eigenvalue and make both embeddings arbitrary.
+
+LANDMARK_FRACTIONS = [0.2, 0.5, 1.0]
+
+
+def get_vectors(filename):
+    return np.loadtxt(filename, delimiter=",", ndmin=2)
+
+
+def exact_embedding(vectors):
+    dist = np.sqrt(((vectors[:, None, :] - vectors[None, :, :]) ** 2).sum(axis=2))
+    w = np.exp(-dist / 2) - np.eye(len(vectors))
+    dinv = 1 / np.sqrt(w.sum(axis=1))
+    lnorm = np.eye(len(vectors)) - dinv[:, None] * w * dinv[None, :]
+    values, eigvectors = np.linalg.eigh(lnorm)
+    eigengap_k = int(np.argmax(np.abs(np.diff(values))[:len(vectors) // 2])) + 1
+    u = eigvectors[:, :eigengap_k]
+    norms = np.linalg.norm(u, axis=1)
+    norms[norms == 0] = 1
+    return eigengap_k, u / norms[:, None]
+
+
+def lloyd_labels(t, k, max_iter=300):
+    # farthest point initialization, so both embeddings get a comparable start
+    centroids = [t[0]]
+    for _ in range(1, k):
+        dist = np.min([((t - c) ** 2).sum(axis=1) for c in centroids], axis=0)
+        centroids.append(t[int(np.argmax(dist))])
+    centroids = np.array(centroids)
+    for _ in range(max_iter):
+        labels = ((t[:, None, :] - centroids[None, :, :]) ** 2).sum(axis=2).argmin(axis=1)
+        new = np.array([t[labels == c].mean(axis=0) if np.any(labels == c) else centroids[c] for c in range(k)])
+        if np.array_equal(new, centroids):
+            break
+        centroids = new
+    return labels
+
+
+def rand_index(labels1, labels2):
+    same1 = labels1[:, None] == labels1[None, :]
+    same2 = labels2[:, None] == labels2[None, :]
+    n = len(labels1)
+    return ((same1 == same2).sum() - n) / (n * (n - 1))
+
+
+if __name__ == "__main__":
+    tests_dir = os.path.join(os.path.dirname(__file__), "test_final_project_v1", "tests")
+    print("file,n,landmarks,eigengap_k,exact_eigengap_k,rand_index")
+    for index in range(11):
+        vectors = get_vectors(os.path.join(tests_dir, f"test{index}.csv"))
+        n = len(vectors)
+        exact_k, t_exact = exact_embedding(vectors)
+        exact_labels = lloyd_labels(t_exact, exact_k)
+        for fraction in LANDMARK_FRACTIONS:
+            landmarks = max(2, int(fraction * n))
+            session = spkmeans.Session(vectors.tolist(), n, vectors.shape[1])
+            nystrom_k = session.embed(0, None, landmarks)
+            session.embed(exact_k, None, landmarks)
+            labels = lloyd_labels(np.array(memoryview(session)), exact_k)
+            print(f"test{index},{n},{landmarks},{nystrom_k},{exact_k},{rand_index(exact_labels, labels):.4f}")
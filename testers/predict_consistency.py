@@ -0,0 +1,45 @@
+import argparse
+import subprocess
+
+# Predicts the training file itself and compares with the labels the spk
+# run gave the same points, one row per landmark count (0 is the exact
+# path):
+#
+#   python testers/predict_consistency.py --binary ./spkmeans --k 5 data.csv
+#
+# The out-of-sample extension should embed a training point where training
+# put it, so nearly all points keep their cluster; exits with 1 when a row
+# falls below --min-agreement. The exact path only matches once jacobi has
+# converged, so large inputs need a higher --rotations.
+
+
+def run(binary, k, path, landmarks, rotations):
+    command = [binary, str(k), "spk", path, "--labels", f"--predict={path}", f"--rotations={rotations}"]
+    if landmarks > 0:
+        command.append(f"--landmarks={landmarks}")
+    lines = subprocess.run(command, capture_output=True, text=True, check=True).stdout.strip().split("\n")
+    labels, predicted = ([int(label) for label in line.split(",")] for line in lines[-2:])
+    return labels, predicted
+
+
+def main():
+    parser = argparse.ArgumentParser(description="predict on the training file vs --labels")
+    parser.add_argument("path")
+    parser.add_argument("--binary", default="./spkmeans")
+    parser.add_argument("--k", type=int, default=0)
+    parser.add_argument("--landmarks", default="0,60,150")
+    parser.add_argument("--rotations", type=int, default=100)
+    parser.add_argument("--min-agreement", type=float, default=0.95)
+    args = parser.parse_args()
+    failed = 0
+    print("landmarks,points,same,agreement")
+    for landmarks in (int(value) for value in args.landmarks.split(",")):
+        labels, predicted = run(args.binary, args.k, args.path, landmarks, args.rotations)
+        same = sum(a == b for a, b in zip(labels, predicted))
+        print(f"{landmarks},{len(labels)},{same},{same / len(labels):.4f}")
+        failed += same / len(labels) < args.min_agreement
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
@@ -160,3 +160,14 @@ if __name__ == "__main__":
                         print("correct output:")
                         print_mat(correct_matrix)
 
+    # jacobi only inputs with their expected output, e.g. a 1 x 1 matrix
+    # that has no off-diagonal element to rotate
+    for name in ["jacobi_n1"]:
+        curr_file = os.path.join(".", "tests", f"{name}.txt")
+        for ex in exec:
+            lng = "P" if ex == "python3 spkmeans.py" else "C"
+            os.system(f"{ex} 0 jacobi {curr_file} > {result_file}")
+            correct_matrix = get_vectors(os.path.join(".", "tests", f"{name}_output.txt"))
+            result_matrix = get_vectors(result_file)
+            res_str = "Passed" if check_equality(correct_matrix, result_matrix) else "Failed"
+            print(f"check file={curr_file} \tlanguage={lng} \tk_value=0 \tgoal=jacobi \tResult={res_str}")
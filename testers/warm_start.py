@@ -0,0 +1,54 @@
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import tempfile
+
+# Compares a cold jacobi with one warm-started from the eigenvectors of an
+# earlier input, e.g. yesterday's data and today's slightly drifted copy:
+#
+#   python testers/warm_start.py --binary ./spkmeans old.csv new.csv
+#
+# The earlier input is solved once to save its basis (--warm=file), then the
+# new input is solved cold and warm and both reports are printed.
+
+FIELDS = ["jacobi_rotations", "jacobi_start_off_norm", "jacobi_off_norm", "jacobi_cap_hit"]
+
+
+def run(binary, goal, path, rotations, workdir, warm=None):
+    profile = os.path.join(workdir, "profile.json")
+    command = [binary, "0", goal, path, f"--rotations={rotations}", f"--profile={profile}"]
+    if warm is not None:
+        command.append(f"--warm={warm}")
+    subprocess.run(command, stdout=subprocess.DEVNULL, check=True)
+    with open(profile) as f:
+        report = json.load(f)
+    seconds = sum(stage["duration_us"] for stage in report["stages"] if stage["name"] == "jacobi") / 1e6
+    return seconds, report["counters"]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="cold vs warm-started jacobi")
+    parser.add_argument("before")
+    parser.add_argument("after")
+    parser.add_argument("--binary", default="./spkmeans")
+    parser.add_argument("--goal", default="spk")
+    parser.add_argument("--rotations", type=int, default=1000000)
+    args = parser.parse_args()
+    with tempfile.TemporaryDirectory() as workdir:
+        basis = os.path.join(workdir, "basis.bin")
+        run(args.binary, args.goal, args.before, args.rotations, workdir, basis)
+        seeded = os.path.join(workdir, "seeded.bin")
+        shutil.copy(basis, seeded)  # the warm run overwrites its basis
+        results = [("cold", *run(args.binary, args.goal, args.after, args.rotations, workdir)),
+                   ("warm", *run(args.binary, args.goal, args.after, args.rotations, workdir, seeded))]
+    print("start,jacobi_s," + ",".join(FIELDS))
+    for name, seconds, counters in results:
+        print(f"{name},{seconds:.6f}," + ",".join(str(counters[field]) for field in FIELDS))
+    cold, warm = results[0][2]["jacobi_rotations"], results[1][2]["jacobi_rotations"]
+    print(f"rotations saved: {cold - warm} ({(cold - warm) / cold:.1%})" if cold else "")
+
+
+if __name__ == "__main__":
+    main()